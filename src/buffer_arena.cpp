@@ -0,0 +1,72 @@
+#include "buffer_arena.h"
+#include "cpu_resources.h"
+
+#include <cstddef>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+BufferArena::BufferArena() {
+}
+
+BufferArena::~BufferArena() {
+    for (auto &buffer : _buffers) {
+        release(buffer);
+    }
+}
+
+BufferArena &BufferArena::of_current_thread() {
+    thread_local BufferArena arena;
+    return arena;
+}
+
+void *BufferArena::get_bytes(const BufferSlot slot, const size_t size) {
+    Buffer &buffer = _buffers[(size_t)slot];
+    if (size > buffer.capacity) {
+        // round up to whole cache lines, the content does not need to be preserved
+        size_t capacity = (size + alignment - 1) / alignment * alignment;
+        release(buffer);
+        allocate(buffer, capacity);
+        size_t total = 0;
+        for (auto &slot_buffer : _buffers) {
+            total += slot_buffer.capacity;
+        }
+        _charge.set(total);
+    }
+    return buffer.data;
+}
+
+void BufferArena::allocate(Buffer &buffer, const size_t capacity) {
+#ifdef __linux__
+    if (is_current_thread_pinned()) {
+        // mappings are aligned to pages, which are multiples of cache lines
+        void *data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            throw bad_alloc();
+        }
+        buffer.data     = data;
+        buffer.capacity = capacity;
+        buffer.mapped   = true;
+        return;
+    }
+#endif
+    buffer.data     = ::operator new(capacity, align_val_t(alignment));
+    buffer.capacity = capacity;
+    buffer.mapped   = false;
+}
+
+void BufferArena::release(Buffer &buffer) {
+#ifdef __linux__
+    if (buffer.mapped) {
+        munmap(buffer.data, buffer.capacity);
+        buffer = Buffer();
+        return;
+    }
+#endif
+    ::operator delete(buffer.data, align_val_t(alignment));
+    buffer = Buffer();
+}
@@ -0,0 +1,62 @@
+//
+// declares class BufferArena providing reusable buffers for the conversion of the audio data
+// Every thread owns its own arena (see BufferArena::of_current_thread()), so the buffers can be used without any
+// synchronization. A buffer is only reallocated if a larger one than ever before is requested for the same slot,
+// so after the first chunks converted by a thread no more allocations happen.
+// All buffers are aligned to cache lines to prevent false sharing between threads
+// and to allow aligned SIMD loads and stores.
+// For a thread pinned to CPUs (see pin_current_thread()) the buffers are mapped freshly instead of taken from the
+// heap, which may return memory freed by a thread running on another NUMA node. The kernel places the pages of a
+// fresh mapping on the node of the thread writing to them first, so the buffers are local to the pinned thread
+//
+
+#ifndef BUFFER_ARENA_H
+#define BUFFER_ARENA_H
+
+#include "memory_budget.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// the buffers that can be used at the same time, every one has its own slot in the arena
+enum class BufferSlot { pcm_samples, float_samples, mp3_data, number_of_slots };
+
+class BufferArena {
+  public:
+    static constexpr std::size_t alignment = 64;  // size of a cache line on all common processors
+
+    BufferArena();
+    ~BufferArena();
+
+    BufferArena(const BufferArena &) = delete;
+    BufferArena &operator=(const BufferArena &) = delete;
+
+    // returns the arena of the calling thread
+    static BufferArena &of_current_thread();
+
+    // returns a buffer of the slot "slot" with room for at least "count" elements of type T
+    // The content of the buffer is undefined and the buffer stays valid until
+    // the next call of get() for the same slot
+    template <typename T>
+    T *get(const BufferSlot slot, const std::size_t count) {
+        return static_cast<T *>(get_bytes(slot, count * sizeof(T)));
+    }
+
+  private:
+    void *get_bytes(const BufferSlot slot, const std::size_t size);
+
+  private:
+    typedef struct Buffer {
+        void *      data     = nullptr;
+        std::size_t capacity = 0;
+        bool        mapped   = false;  // mapped freshly for a pinned thread instead of allocated on the heap
+    } Buffer;
+
+    static void allocate(Buffer &buffer, const std::size_t capacity);
+    static void release(Buffer &buffer);
+
+    Buffer       _buffers[(std::size_t)BufferSlot::number_of_slots];
+    MemoryCharge _charge;  // the capacities of all buffers
+};
+
+#endif  // BUFFER_ARENA_H
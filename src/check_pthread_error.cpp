@@ -15,7 +15,7 @@ using namespace std;
 #endif
 
 #define MAX_ERROR_STRING_LENGTH 256
-void check_pthread_error(int errnum, const string &pthread_function_name) {
+void check_pthread_error(int errnum, const char *pthread_function_name) {
     if (errnum) {
         ostringstream ss;
         char          errmsg[MAX_ERROR_STRING_LENGTH];
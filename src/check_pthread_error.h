@@ -3,6 +3,7 @@
 
 #include <string>
 
-extern void check_pthread_error(int errnum, const std::string &pthread_function_name);
+// takes the function name as C string, so that the check does not allocate memory in the common case of no error
+extern void check_pthread_error(int errnum, const char *pthread_function_name);
 
 #endif  // CHECK_PTHREAD_ERROR_H
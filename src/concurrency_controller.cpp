@@ -0,0 +1,103 @@
+#include "concurrency_controller.h"
+#include "tiostream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#define ADAPT_PREFIX "   [ ADAPT ] "
+
+using namespace std;
+
+// the controller the calling worker thread is attached to and its thread number, see attach_current_thread()
+static thread_local ConcurrencyController *current_controller    = nullptr;
+static thread_local uint16_t               current_thread_number = 0;
+
+static int64_t nanoseconds_now() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ConcurrencyController::ConcurrencyController(const uint16_t min_threads, const uint16_t max_threads,
+                                             const unsigned int cpus, const chrono::milliseconds interval)
+    : _min_threads(min_threads)
+    , _max_threads(max_threads)
+    , _cpus(cpus)
+    , _interval(chrono::duration_cast<chrono::nanoseconds>(interval).count())
+    , _times(max_threads)
+    , _pool(nullptr)
+    , _next_decision(0) {
+}
+
+void ConcurrencyController::attach_current_thread(const uint16_t thread_number) {
+    current_controller    = this;
+    current_thread_number = thread_number;
+}
+
+void ConcurrencyController::control(ThreadPool &pool, const uint16_t initial_threads) {
+    pool.set_active_threads(initial_threads);
+    _next_decision = nanoseconds_now() + _interval;
+    _pool          = &pool;
+}
+
+void ConcurrencyController::record(const WorkerActivity activity, const int64_t nanoseconds, const int64_t now) {
+    ConcurrencyController *controller = current_controller;
+    WorkerTimes &          times      = controller->_times[current_thread_number];
+    (activity == WorkerActivity::io ? times.io : times.encoding).fetch_add(nanoseconds, memory_order_relaxed);
+    // only the worker advancing the time of the next decision takes the decision
+    int64_t decision = controller->_next_decision;
+    if (controller->_pool == nullptr || now < decision
+        || !controller->_next_decision.compare_exchange_strong(decision, now + controller->_interval)) {
+        return;
+    }
+    controller->adapt();
+}
+
+void ConcurrencyController::adapt() {
+    int64_t io       = 0;
+    int64_t encoding = 0;
+    for (auto &times : _times) {
+        io += times.io.exchange(0, memory_order_relaxed);
+        encoding += times.encoding.exchange(0, memory_order_relaxed);
+    }
+    if (encoding == 0) {
+        return;  // nothing has been encoded during the interval, so there is no basis for a decision
+    }
+    ThreadPool *pool     = _pool;
+    uint16_t    active   = pool->active_threads();
+    double      io_share = (double)io / (double)(io + encoding);
+    // while a thread waits for I/O its CPU can run another thread
+    double   ideal  = (double)_cpus / max(1.0 - io_share, 0.01);
+    uint32_t target = (uint32_t)min(lround(ideal), (long)_max_threads);
+    // changing the number at most by a factor of two per interval keeps a single interval with unusual
+    // storage latencies from making the number jump
+    target = min(target, 2u * active);
+    target = max(target, (active + 1u) / 2u);
+    target = max(target, (uint32_t)_min_threads);
+    target = min(target, (uint32_t)_max_threads);
+    if (target == active) {
+        return;
+    }
+    pool->set_active_threads((uint16_t)target);
+    ostringstream ss;
+    ss << ADAPT_PREFIX << active << " -> " << target << " threads encoding, " << fixed << setprecision(0)
+       << io_share * 100.0 << " % of their time waiting for I/O" << endl;
+    tcout << ss.str();
+}
+
+ActivityTimer::ActivityTimer(const WorkerActivity activity)
+    : _activity(activity)
+    , _measuring(current_controller != nullptr)
+    , _start(_measuring ? nanoseconds_now() : 0) {
+}
+
+ActivityTimer::~ActivityTimer() {
+    if (_measuring) {
+        int64_t now = nanoseconds_now();
+        ConcurrencyController::record(_activity, now - _start, now);
+    }
+}
+
+bool ActivityTimer::measuring() const {
+    return _measuring;
+}
@@ -0,0 +1,89 @@
+//
+// declares class ConcurrencyController adapting the number of active threads of a ThreadPool at runtime
+// The threads encoding do not only spend their time in lame, they also wait for the audio data to be read and for
+// the MP3 data to be written. While a thread waits its CPU is idle, so with slow storage more threads than CPUs are
+// needed to keep all CPUs busy, while with fast storage additional threads only compete for the CPUs.
+// The controller compares the time the threads spent waiting for I/O with the time they spent encoding, measured
+// by ActivityTimer, and once per interval sets the number of active threads to the number keeping all CPUs busy:
+//     CPUs / (1 - share of the time waiting for I/O)
+// limited to the bounds passed and to half or twice the current number. Every change is printed as a trace line.
+// The decisions are taken by the worker threads themselves when they record a time after the interval elapsed,
+// so no additional thread is needed
+//
+
+#ifndef CONCURRENCY_CONTROLLER_H
+#define CONCURRENCY_CONTROLLER_H
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// the activities of a worker thread whose times are compared by the ConcurrencyController
+enum class WorkerActivity { io, encoding };
+
+class ConcurrencyController {
+  public:
+    // the number of active threads is adapted between "min_threads" and "max_threads" every "interval"
+    // "cpus" is the number of CPUs the threads share
+    ConcurrencyController(const std::uint16_t min_threads, const std::uint16_t max_threads, const unsigned int cpus,
+                          const std::chrono::milliseconds interval);
+
+    ConcurrencyController(const ConcurrencyController &) = delete;
+    ConcurrencyController &operator=(const ConcurrencyController &) = delete;
+
+    // must be called by every worker thread "thread_number" of the pool controlled before it executes any function,
+    // see the argument "initialize_thread" of the constructor of ThreadPool
+    void attach_current_thread(const std::uint16_t thread_number);
+
+    // starts controlling "pool", which must have "max_threads" threads, with "initial_threads" active threads
+    void control(ThreadPool &pool, const std::uint16_t initial_threads);
+
+  private:
+    friend class ActivityTimer;
+
+    // the times a worker spent on its activities since the last decision in nanoseconds
+    // Every worker writes only its own times, they are aligned to cache lines to prevent false sharing
+    typedef struct alignas(64) WorkerTimes {
+        std::atomic<std::int64_t> io{0};
+        std::atomic<std::int64_t> encoding{0};
+    } WorkerTimes;
+
+    // adds "nanoseconds" to the time spent on "activity" by the calling worker
+    // and adapts the number of active threads if the interval has elapsed at "now"
+    static void record(const WorkerActivity activity, const std::int64_t nanoseconds, const std::int64_t now);
+    // sets the number of active threads from the times recorded since the last decision
+    void adapt();
+
+  private:
+    const std::uint16_t       _min_threads;
+    const std::uint16_t       _max_threads;
+    const unsigned int        _cpus;
+    const std::int64_t        _interval;       // in nanoseconds
+    std::vector<WorkerTimes>  _times;          // indexed by thread number
+    std::atomic<ThreadPool *> _pool;           // nullptr until control() is called
+    std::atomic<std::int64_t> _next_decision;  // time of the next decision in nanoseconds since the clock's epoch
+};
+
+// measures the time from its construction to its destruction as time the calling worker thread spent on "activity"
+// does nothing if the calling thread is not attached to a ConcurrencyController
+class ActivityTimer {
+  public:
+    explicit ActivityTimer(const WorkerActivity activity);
+    ~ActivityTimer();
+
+    ActivityTimer(const ActivityTimer &) = delete;
+    ActivityTimer &operator=(const ActivityTimer &) = delete;
+
+    // returns true if the time is recorded, i.e. the calling thread is attached to a ConcurrencyController
+    bool measuring() const;
+
+  private:
+    const WorkerActivity _activity;
+    const bool           _measuring;
+    std::int64_t         _start;  // in nanoseconds since the clock's epoch
+};
+
+#endif  // CONCURRENCY_CONTROLLER_H
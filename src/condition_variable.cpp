@@ -19,3 +19,7 @@ void pthread::condition_variable::notify_one() {
     int res = pthread_cond_signal(&_cond_var);
     check_pthread_error(res, "pthread_cond_signal");
 }
+void pthread::condition_variable::notify_all() {
+    int res = pthread_cond_broadcast(&_cond_var);
+    check_pthread_error(res, "pthread_cond_broadcast");
+}
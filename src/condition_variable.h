@@ -18,6 +18,7 @@ class condition_variable {
     void                lock();
     void                unlock();
     void                notify_one();
+    void                notify_all();
 
   private:
     pthread_cond_t _cond_var;
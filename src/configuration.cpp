@@ -10,12 +10,15 @@
 
 #include "configuration.h"
 #include <lame/lame.h>
+#include <algorithm>
 #include <cstdint>
 #include <cxxopts.hpp>
 #include <filesystem>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include "cpu_resources.h"
+#include "io_uring.h"
 #include "return_code.h"
 #include "thread_includes.h"
 
@@ -24,13 +27,30 @@ namespace fs = std::filesystem;
 
 string Configuration::_version = WAV2MP3_VERSION;  // passed via -D compiler option
                                                    // by CMake-generated Makefile
-string   Configuration::_name                   = fs::path(WAV2MP3_NAME).filename().string();
-string   Configuration::_directory_path         = ".";
-bool     Configuration::_recurse_directories    = RECURSE_DIRECTORIES;
-int      Configuration::_encoding_quality       = ENCODING_QUALITY;
-bool     Configuration::_overwrite_existing_mp3 = OVERWRITE_EXISTING_MP3;
-bool     Configuration::_convert_all_files      = CONVERT_ALL_FILES;
-uint16_t Configuration::_number_of_threads      = pthread::thread::hardware_concurrency();
+string         Configuration::_name                   = fs::path(WAV2MP3_NAME).filename().string();
+string         Configuration::_directory_path         = ".";
+bool           Configuration::_recurse_directories    = RECURSE_DIRECTORIES;
+int            Configuration::_encoding_quality       = ENCODING_QUALITY;
+bool           Configuration::_overwrite_existing_mp3 = OVERWRITE_EXISTING_MP3;
+bool           Configuration::_convert_all_files      = CONVERT_ALL_FILES;
+uint16_t       Configuration::_number_of_threads      = available_cpus();
+uint16_t       Configuration::_io_threads             = IO_THREADS;
+InputBackend   Configuration::_input_backend          = InputBackend::ifstream;
+OutputBackend  Configuration::_output_backend         = OutputBackend::buffered;
+uint32_t       Configuration::_read_ahead             = READ_AHEAD_DEPTH;
+uint32_t       Configuration::_look_ahead             = 0;
+uint32_t       Configuration::_scan_fan_out           = 0;
+bool           Configuration::_unordered_walk         = UNORDERED_WALK;
+SchedulePolicy Configuration::_schedule_policy        = SchedulePolicy::stream;
+uint32_t       Configuration::_segment_seconds        = SEGMENT_SECONDS;
+uint32_t       Configuration::_batch_bytes            = BATCH_BYTES;
+
+vector<unsigned int> Configuration::_cpu_set;
+bool                 Configuration::_numa_interleave = NUMA_INTERLEAVE;
+uint16_t             Configuration::_min_threads     = MIN_THREADS;
+uint16_t             Configuration::_max_threads     = MAX_THREADS;
+uint32_t             Configuration::_adapt_interval  = ADAPT_INTERVAL_MS;
+uint32_t             Configuration::_memory_limit    = MEMORY_LIMIT_MB;
 
 // handles processing of command line arguments and setting the configuration parameters accordingly
 // uses cxxopts to do the job
@@ -40,6 +60,11 @@ bool Configuration::parse_arguments(int argc, char *argv[]) {
     options.positional_help("directory");
     // clang-format off
     vector<string> superfluous_arguments;
+    string         input_backend;
+    string         output_backend;
+    string         schedule_policy;
+    string         cpu_set;
+    uint16_t       cpu_threads = 0;
     options.add_options()
         ("h,help", "print help")
         ("v,version", "print version")
@@ -50,8 +75,60 @@ bool Configuration::parse_arguments(int argc, char *argv[]) {
         ("q,quality", "set quality level of MP3 compression (integer between 0 (highest) and 9 (lowest))",
          cxxopts::value<int>(_encoding_quality)->default_value(std::to_string(_encoding_quality)))
         ("a,all", "try to convert all files, not only those with the extension .wav.", cxxopts::value<bool>(_convert_all_files))
-        ("t,threads", "number of threads (maximum " + to_string(_number_of_threads) + ")",
+        ("t,threads", "number of threads encoding, by default the number of CPUs available to the process "
+         "(limited by its CPU affinity and its cgroup CPU quota), more can be passed for overlapping I/O",
          cxxopts::value<uint16_t>(_number_of_threads)->default_value(to_string(_number_of_threads)))
+        ("cpu-threads", "number of threads encoding, same as -t/--threads", cxxopts::value<uint16_t>(cpu_threads))
+        ("io-threads", "number of threads reading directories, probing the WAV files and creating the MP3 files, "
+         "0 for doing this in the threads encoding",
+         cxxopts::value<uint16_t>(_io_threads)->default_value(to_string(IO_THREADS)))
+        ("i,input", "way of reading the WAV files: \"ifstream\" (read into buffers), \"mmap\" (map into memory) "
+         "or \"io_uring\" (read ahead asynchronously, Linux only)",
+         cxxopts::value<string>(input_backend)->default_value(INPUT_BACKEND))
+        ("output", "way of writing the MP3 files: \"ofstream\", \"buffered\" (few large writes into a preallocated "
+         "file) or \"io_uring\" (write asynchronously, Linux only)",
+         cxxopts::value<string>(output_backend)->default_value(OUTPUT_BACKEND))
+        ("read-ahead", "number of blocks of the audio data of a WAV file read ahead while the previous ones are "
+         "encoded, by a helper thread for \"ifstream\" or asynchronously for \"io_uring\", 0 for not reading ahead",
+         cxxopts::value<uint32_t>(_read_ahead)->default_value(to_string(READ_AHEAD_DEPTH)))
+        ("look-ahead", "number of WAV files found ahead and kept ready for the next free thread, "
+         "0 for " + to_string(LOOK_AHEAD_PER_THREAD) + " per thread",
+         cxxopts::value<uint32_t>(_look_ahead)->default_value("0"))
+        ("scan-fan-out", "number of directories read in parallel or ahead when recursing through sub-directories, "
+         "0 for " + to_string(SCAN_FAN_OUT_PER_THREAD) + " per thread",
+         cxxopts::value<uint32_t>(_scan_fan_out)->default_value("0"))
+        ("unordered", "convert the WAV files as soon as their directory has been read instead of in the order of "
+         "a serial walk through the sub-directories",
+         cxxopts::value<bool>(_unordered_walk))
+        ("schedule", "order of converting the WAV files: \"stream\" (while walking the directories) or, after "
+         "probing all files, \"fifo\" (in the order found), \"longest-first\", \"shortest-first\" or "
+         "\"directory\" (grouped by directory) reporting the predicted and the actual time needed",
+         cxxopts::value<string>(schedule_policy)->default_value(SCHEDULE_POLICY))
+        ("segment-seconds", "split WAV files longer than the passed number of seconds into segments of this length "
+         "encoded by several threads in parallel, 0 for not splitting. The segments are encoded without the bit "
+         "reservoir, which costs some quality at the same bit rate",
+         cxxopts::value<uint32_t>(_segment_seconds)->default_value(to_string(SEGMENT_SECONDS)))
+        ("batch-bytes", "convert WAV files with less than the passed number of bytes of audio data in batches of "
+         "about this size, each converted by one thread one file after the other, the files converted per second "
+         "are reported at the end, 0 for not batching",
+         cxxopts::value<uint32_t>(_batch_bytes)->default_value(to_string(BATCH_BYTES)))
+        ("cpu-set", "list of CPUs like \"0-3,8\" the threads encoding are pinned to one after the other, the "
+         "I/O threads may run on all of them. Without -t/--threads there are as many threads encoding as CPUs listed",
+         cxxopts::value<string>(cpu_set))
+        ("numa-interleave", "pin the threads encoding to the NUMA nodes of the host in turn, each thread to the "
+         "CPUs of its node (only those of --cpu-set, if passed), so it uses memory local to that node",
+         cxxopts::value<bool>(_numa_interleave))
+        ("max-threads", "adapt the number of threads encoding at runtime up to the passed number, starting with "
+         "-t/--threads, so the CPUs are kept busy while threads wait for I/O, each change is printed, "
+         "0 for a fixed number",
+         cxxopts::value<uint16_t>(_max_threads)->default_value(to_string(MAX_THREADS)))
+        ("min-threads", "lower bound of the number of threads encoding adapted at runtime",
+         cxxopts::value<uint16_t>(_min_threads)->default_value(to_string(MIN_THREADS)))
+        ("adapt-interval", "milliseconds between two adaptions of the number of threads encoding",
+         cxxopts::value<uint32_t>(_adapt_interval)->default_value(to_string(ADAPT_INTERVAL_MS)))
+        ("memory-limit", "megabytes the buffers of the files being converted may use at most, no more files are "
+         "started while the limit is reached, the peak is reported at the end, 0 for no limit",
+         cxxopts::value<uint32_t>(_memory_limit)->default_value(to_string(MEMORY_LIMIT_MB)))
         ("directory", "root directory to search for WAV files", cxxopts::value<string>(_directory_path))
         ("superfluous", "", cxxopts::value<vector<string> >(superfluous_arguments));
     // clang-format on
@@ -84,12 +161,101 @@ bool Configuration::parse_arguments(int argc, char *argv[]) {
             cerr << options.help({""}) << endl;
             return false;
         }
+        if (input_backend == "ifstream") {
+            _input_backend = InputBackend::ifstream;
+        } else if (input_backend == "mmap") {
+            _input_backend = InputBackend::mmap;
+        } else if (input_backend == "io_uring") {
+            _input_backend = InputBackend::io_uring;
+        } else {
+            cerr << "ERROR: input must be one of \"ifstream\", \"mmap\" or \"io_uring\"" << endl;
+            cerr << options.help({""}) << endl;
+            return false;
+        }
+        if (output_backend == "ofstream") {
+            _output_backend = OutputBackend::ofstream;
+        } else if (output_backend == "buffered") {
+            _output_backend = OutputBackend::buffered;
+        } else if (output_backend == "io_uring") {
+            _output_backend = OutputBackend::io_uring;
+        } else {
+            cerr << "ERROR: output must be one of \"ofstream\", \"buffered\" or \"io_uring\"" << endl;
+            cerr << options.help({""}) << endl;
+            return false;
+        }
+        if (schedule_policy == "stream") {
+            _schedule_policy = SchedulePolicy::stream;
+        } else if (schedule_policy == "fifo") {
+            _schedule_policy = SchedulePolicy::fifo;
+        } else if (schedule_policy == "longest-first") {
+            _schedule_policy = SchedulePolicy::longest_first;
+        } else if (schedule_policy == "shortest-first") {
+            _schedule_policy = SchedulePolicy::shortest_first;
+        } else if (schedule_policy == "directory") {
+            _schedule_policy = SchedulePolicy::directory;
+        } else {
+            cerr << "ERROR: schedule must be one of \"stream\", \"fifo\", \"longest-first\", \"shortest-first\" or "
+                    "\"directory\""
+                 << endl;
+            cerr << options.help({""}) << endl;
+            return false;
+        }
+        if ((_input_backend == InputBackend::io_uring || _output_backend == OutputBackend::io_uring)
+            && !IoUring::is_supported()) {
+            cerr << "WARNING: io_uring is not supported by this system, using \"ifstream\" and \"buffered\" instead"
+                 << endl;
+            _input_backend  = _input_backend == InputBackend::io_uring ? InputBackend::ifstream : _input_backend;
+            _output_backend = _output_backend == OutputBackend::io_uring ? OutputBackend::buffered : _output_backend;
+        }
+        unsigned int cpus = available_cpus();
+        if (result.count("cpu-set")) {
+            vector<unsigned int> allowed_cpus = affinity_mask_cpus();
+            if (!parse_cpu_list(cpu_set, _cpu_set)) {
+                cerr << "ERROR: cpu-set must be a list of CPUs like \"0-3,8\"" << endl;
+                cerr << options.help({""}) << endl;
+                return false;
+            }
+            if (!allowed_cpus.empty()
+                && !includes(allowed_cpus.begin(), allowed_cpus.end(), _cpu_set.begin(), _cpu_set.end())) {
+                cerr << "ERROR: cpu-set contains CPUs the process is not allowed to run on" << endl;
+                cerr << options.help({""}) << endl;
+                return false;
+            }
+            cpus = min(cpus, (unsigned int)_cpu_set.size());
+            if (!result.count("threads") && !result.count("cpu-threads")) {
+                _number_of_threads = (uint16_t)cpus;
+            }
+        }
+        if (result.count("cpu-threads")) {
+            _number_of_threads = cpu_threads;
+        }
         _number_of_threads = _number_of_threads < 1 ? 1 : _number_of_threads;  // at least one thread is necessary
-        if (_number_of_threads > pthread::thread::hardware_concurrency()) {
-            auto hardware_concurrency = pthread::thread::hardware_concurrency();
-            cerr << "WARNING: Number of threads reduced from " << _number_of_threads << " to " << hardware_concurrency
-                 << " (maximum number of concurrently running threads supported by hardware)" << endl;
-            _number_of_threads = hardware_concurrency;
+        if (_max_threads > 0) {
+            _min_threads = _min_threads < 1 ? 1 : _min_threads;
+            if (_min_threads > _max_threads) {
+                cerr << "ERROR: min-threads must not be larger than max-threads" << endl;
+                cerr << options.help({""}) << endl;
+                return false;
+            }
+            if (_adapt_interval == 0) {
+                cerr << "ERROR: adapt-interval must be at least 1 millisecond" << endl;
+                cerr << options.help({""}) << endl;
+                return false;
+            }
+            // the number of threads is only the initial one, so it is kept within the bounds
+            _number_of_threads = max(_number_of_threads, _min_threads);
+            _number_of_threads = min(_number_of_threads, _max_threads);
+        }
+        if (_number_of_threads > cpus) {
+            // not reduced, more threads than CPUs can pay off if the threads often wait for I/O
+            cerr << "WARNING: " << _number_of_threads << " threads exceed the " << cpus
+                 << " CPUs available to the process (CPU affinity, cgroup CPU quota and --cpu-set)" << endl;
+        }
+        if (_look_ahead == 0) {
+            _look_ahead = LOOK_AHEAD_PER_THREAD * (uint32_t)_number_of_threads;
+        }
+        if (_scan_fan_out == 0) {
+            _scan_fan_out = SCAN_FAN_OUT_PER_THREAD * (uint32_t)_number_of_threads;
         }
     } catch (const cxxopts::OptionParseException &e) {
         cerr << "ERROR: " << e.what() << endl;
@@ -124,6 +290,70 @@ uint16_t Configuration::number_of_threads() {
     return Configuration::_number_of_threads;
 }
 
+uint16_t Configuration::io_threads() {
+    return Configuration::_io_threads;
+}
+
+InputBackend Configuration::input_backend() {
+    return Configuration::_input_backend;
+}
+
+OutputBackend Configuration::output_backend() {
+    return Configuration::_output_backend;
+}
+
+uint32_t Configuration::read_ahead() {
+    return Configuration::_read_ahead;
+}
+
+uint32_t Configuration::look_ahead() {
+    return Configuration::_look_ahead;
+}
+
+uint32_t Configuration::scan_fan_out() {
+    return Configuration::_scan_fan_out;
+}
+
+bool Configuration::unordered_walk() {
+    return Configuration::_unordered_walk;
+}
+
+SchedulePolicy Configuration::schedule_policy() {
+    return Configuration::_schedule_policy;
+}
+
+uint32_t Configuration::segment_seconds() {
+    return Configuration::_segment_seconds;
+}
+
+uint32_t Configuration::batch_bytes() {
+    return Configuration::_batch_bytes;
+}
+
+vector<unsigned int> Configuration::cpu_set() {
+    return Configuration::_cpu_set;
+}
+
+bool Configuration::numa_interleave() {
+    return Configuration::_numa_interleave;
+}
+
+uint16_t Configuration::min_threads() {
+    return Configuration::_min_threads;
+}
+
+uint16_t Configuration::max_threads() {
+    return Configuration::_max_threads;
+}
+
+uint32_t Configuration::adapt_interval() {
+    return Configuration::_adapt_interval;
+}
+
+uintmax_t Configuration::memory_limit() {
+    return (uintmax_t)Configuration::_memory_limit * 1024 * 1024;
+}
+
 string Configuration::version() {
     ostringstream ss;
     ss << _name << " " << _version << " using lame " << get_lame_version() << ", ";
@@ -3,35 +3,95 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 #define RECURSE_DIRECTORIES false
 #define ENCODING_QUALITY 5
 #define OVERWRITE_EXISTING_MP3 false
 #define CONVERT_ALL_FILES false
+#define IO_THREADS 2  // default number of threads reading directories, probing WAV files and creating MP3 files
+#define INPUT_BACKEND "ifstream"
+#define OUTPUT_BACKEND "buffered"
+#define READ_AHEAD_DEPTH 4  // default number of blocks of the audio data of a WAV file read ahead while encoding
+#define LOOK_AHEAD_PER_THREAD 2    // default number of probed WAV files waiting for a free thread per thread
+#define SCAN_FAN_OUT_PER_THREAD 4  // default number of directories queued or read ahead per thread
+#define UNORDERED_WALK false
+#define SCHEDULE_POLICY "stream"
+#define BATCH_BYTES 0  // size of the audio data of small WAV files converted as one task, 0 for not batching
+#define SEGMENT_SECONDS 0  // length of the segments of a long WAV file encoded in parallel, 0 for not splitting
+#define NUMA_INTERLEAVE false
+#define MIN_THREADS 1           // lower bound of the threads encoding adapted at runtime
+#define MAX_THREADS 0           // upper bound of the threads encoding adapted at runtime, 0 for a fixed number
+#define ADAPT_INTERVAL_MS 1000  // interval of adapting the number of threads encoding in milliseconds
+#define MEMORY_LIMIT_MB 0       // limit of the memory of the buffers of the files in flight, 0 for no limit
+
+// the ways of reading the WAV files that can be selected with the option --input
+enum class InputBackend { ifstream, mmap, io_uring };
+// the ways of writing the MP3 files that can be selected with the option --output
+enum class OutputBackend { ofstream, buffered, io_uring };
+// the orders of converting the WAV files that can be selected with the option --schedule
+// all but "stream" probe all files first, see class Schedule
+enum class SchedulePolicy { stream, fifo, longest_first, shortest_first, directory };
 
 class Configuration {
   public:
     static bool parse_arguments(int argc, char* argv[]);
 
-    static std::string   directory_path();
-    static bool          recurse_directories();
-    static int           encoding_quality();
-    static bool          overwrite_existing_mp3();
-    static bool          convert_all_files();
-    static std::uint16_t number_of_threads();
+    static std::string    directory_path();
+    static bool           recurse_directories();
+    static int            encoding_quality();
+    static bool           overwrite_existing_mp3();
+    static bool           convert_all_files();
+    static std::uint16_t  number_of_threads();
+    static std::uint16_t  io_threads();
+    static InputBackend   input_backend();
+    static OutputBackend  output_backend();
+    static std::uint32_t  read_ahead();
+    static std::uint32_t  look_ahead();
+    static std::uint32_t  scan_fan_out();
+    static bool           unordered_walk();
+    static SchedulePolicy schedule_policy();
+    static std::uint32_t  segment_seconds();
+    static std::uint32_t  batch_bytes();
+    // the CPUs selected with --cpu-set in ascending order, empty if all CPUs may be used
+    static std::vector<unsigned int> cpu_set();
+    static bool                      numa_interleave();
+    // the bounds of the number of threads encoding adapted at runtime, max_threads() is 0 if it is fixed
+    static std::uint16_t             min_threads();
+    static std::uint16_t             max_threads();
+    static std::uint32_t             adapt_interval();
+    // the limit of the memory of the buffers of the files in flight in bytes, 0 if there is no limit
+    static std::uintmax_t            memory_limit();
 
   private:
     static std::string version();
 
   private:
-    static std::string   _name;
-    static std::string   _version;
-    static std::string   _directory_path;
-    static bool          _recurse_directories;
-    static int           _encoding_quality;
-    static bool          _overwrite_existing_mp3;
-    static bool          _convert_all_files;
-    static std::uint16_t _number_of_threads;
+    static std::string    _name;
+    static std::string    _version;
+    static std::string    _directory_path;
+    static bool           _recurse_directories;
+    static int            _encoding_quality;
+    static bool           _overwrite_existing_mp3;
+    static bool           _convert_all_files;
+    static std::uint16_t  _number_of_threads;
+    static std::uint16_t  _io_threads;
+    static InputBackend   _input_backend;
+    static OutputBackend  _output_backend;
+    static std::uint32_t  _read_ahead;
+    static std::uint32_t  _look_ahead;
+    static std::uint32_t  _scan_fan_out;
+    static bool           _unordered_walk;
+    static SchedulePolicy _schedule_policy;
+    static std::uint32_t  _segment_seconds;
+    static std::uint32_t  _batch_bytes;
+
+    static std::vector<unsigned int> _cpu_set;
+    static bool                      _numa_interleave;
+    static std::uint16_t             _min_threads;
+    static std::uint16_t             _max_threads;
+    static std::uint32_t             _adapt_interval;
+    static std::uint32_t             _memory_limit;  // in MB
 };
 
 #endif  // CONFIGURATION_H
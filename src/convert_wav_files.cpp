@@ -14,24 +14,43 @@
 
 #include "convert_wav_files.h"
 
+#include "buffer_arena.h"
+#include "concurrency_controller.h"
 #include "configuration.h"
+#include "cpu_resources.h"
+#include "directory_walker.h"
+#include "input_file.h"
 #include "lame_init.h"
+#include "memory_budget.h"
+#include "mp3_format.h"
+#include "output_file.h"
 #include "return_code.h"
 #include "riff_format.h"
+#include "sample_conversion.h"
+#include "schedule.h"
 #include "signal_handler.h"
+#include "task_batcher.h"
+#include "thread_includes.h"
 #include "thread_pool.h"
 #include "tiostream.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <exception>
 #include <filesystem>
-#include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
-#include <map>
+#include <iterator>
+#include <memory>
 #include <set>
 #include <sstream>
 #include <tuple>
+#include <vector>
 
 #define ERROR_PREFIX "   [ ERROR ] "
 #define OK_PREFIX "   [  OK   ] "
@@ -40,18 +59,86 @@
 namespace fs = std::filesystem;
 using namespace std;
 
+// number of MP3 files completed, reported by convert_all_wav_files_in_directory() together with the throughput
+static atomic<size_t> number_of_converted_files(0);
+
 // helper type storing both the start offset and the size of the data payload
 // of a chunk
 typedef struct ChunkPosition {
-    std::streampos  start;  // position to pass to ifstream::seekg(...) to move file pointer to beggining of chunk data
-    std::streamsize data_size = 0;  // size of chunk data.
+    std::uintmax_t start     = 0;  // offset of the beginning of the chunk data in the file, see InputFile::view()
+    std::uintmax_t data_size = 0;  // size of chunk data.
 } ChunkPosition;
 
-// helper type mapping the chunk id to the position information of its data
-typedef std::map<std::string, ChunkPosition> ChunkPositionMap;
+// helper type mapping the FOURCC chunk id (see fourcc() in riff_format.h) to the position information of its data
+// A WAV file contains only a handful of chunks, so they are stored in a small flat array which is searched linearly.
+// That is faster than a tree and needs no memory allocations, only files with an unusual number of different chunks
+// spill over into a vector
+class ChunkPositionMap {
+  public:
+    // returns the position of the chunk with id "fourcc" or nullptr if there is none
+    const ChunkPosition *find(const uint32_t fourcc) const {
+        for (size_t i = 0; i < _size; i++) {
+            const Entry &entry = i < inline_capacity ? _inline[i] : _overflow[i - inline_capacity];
+            if (entry.id == fourcc) {
+                return &entry.position;
+            }
+        }
+        return nullptr;
+    }
+
+    bool contains(const uint32_t fourcc) const {
+        return find(fourcc) != nullptr;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    // adds the chunk, a chunk with the same id already present is replaced
+    void insert_or_assign(const uint32_t fourcc, const ChunkPosition &position) {
+        ChunkPosition *present = (ChunkPosition *)find(fourcc);
+        if (present) {
+            *present = position;
+        } else {
+            append(fourcc, position);
+        }
+    }
+
+    // adds all chunks of "other" with ids not present yet, the chunks already present are kept
+    void insert(const ChunkPositionMap &other) {
+        for (size_t i = 0; i < other._size; i++) {
+            const Entry &entry = i < inline_capacity ? other._inline[i] : other._overflow[i - inline_capacity];
+            if (!contains(entry.id)) {
+                append(entry.id, entry.position);
+            }
+        }
+    }
+
+  private:
+    void append(const uint32_t fourcc, const ChunkPosition &position) {
+        if (_size < inline_capacity) {
+            _inline[_size] = {fourcc, position};
+        } else {
+            _overflow.push_back({fourcc, position});
+        }
+        _size++;
+    }
+
+  private:
+    typedef struct Entry {
+        uint32_t      id = 0;
+        ChunkPosition position;
+    } Entry;
+
+    static constexpr size_t inline_capacity = 16;
+
+    Entry         _inline[inline_capacity];
+    vector<Entry> _overflow;
+    size_t        _size = 0;
+};
 
 /*!
- * Read all chunks from file starting at stream position start to at max the stream position start + max_data_size
+ * Read all chunks from file starting at file offset start to at max the file offset start + max_data_size
  * Returns a tuple of:
  *     - ChunkPositionMap: maps the FOURCC chunk ids of all valid chunks found to
  *       the positions and sizes of their data blocks.
@@ -59,68 +146,54 @@ typedef std::map<std::string, ChunkPosition> ChunkPositionMap;
  *     - string: is empty if everything went fine, otherwise it contains a warning or error message.
  */
 
-static tuple<ChunkPositionMap, string> read_all_chunks(ifstream &file, const streampos &start,
-                                                       const streamsize &max_data_size) {
+static tuple<ChunkPositionMap, string> read_all_chunks(InputFile &file, const uintmax_t start,
+                                                       const uintmax_t max_data_size) {
     // now inspect all chunks and store their positions and sizes
     ostringstream    ss;
     ChunkPositionMap chunk_positions;
-    file.seekg(start);
 
-    auto pad_data_size = [](const streamsize chunk_data_size) {
-        streamsize padded_data_size = chunk_data_size / sizeof(uint16_t) * sizeof(uint16_t);
+    auto pad_data_size = [](const uintmax_t chunk_data_size) {
+        uintmax_t padded_data_size = chunk_data_size / sizeof(uint16_t) * sizeof(uint16_t);
         if (chunk_data_size % sizeof(uint16_t)) {
             padded_data_size += sizeof(uint16_t);
         }
         return padded_data_size;
     };
 
-    streamsize padded_max_data_size = pad_data_size(max_data_size);
-    while (!(file.eof() || file.fail())) {
-        char     chunk_id_raw[4];
-        uint32_t chunk_data_size;
-
-        file.read(chunk_id_raw, sizeof(chunk_id_raw));                 // first read FOURCC id of chunk
-        file.read((char *)&chunk_data_size, sizeof(chunk_data_size));  // then the size of valid data in the data block
-        if (file.eof() || file.fail()) {
+    uintmax_t end      = start + pad_data_size(max_data_size);
+    uintmax_t position = start;
+    while (true) {
+        // a chunk starts with its FOURCC id followed by the size of valid data in the data block
+        const size_t chunk_header_size = 4 + sizeof(uint32_t);
+        const byte * chunk_header      = file.view(position, chunk_header_size);
+        if (!chunk_header) {
             ss << "Reading chunk id and size failed.";
             break;
         }
-        streamsize padded_chunk_data_size = pad_data_size(chunk_data_size);
-
-        string chunk_id(chunk_id_raw, sizeof(chunk_id_raw));
-        // store start of data position in ChunkPosition struct first
-        // but do NOT store it yet...
-        ChunkPosition chunk_pos = {file.tellg(), chunk_data_size};
-
-        // ... first advance pointer to the position of the last byte of the valid data block according to
-        // padded_chunk_data_size
-        file.seekg(chunk_data_size - 1, ios_base::cur);
-        // then peek for the byte to enforce the eofbit or failbit to be set if not enough data is available
-        file.peek();
-        // check also if the chunk claims to reach beyond the padded_max_data_size
-        if (file.eof() || file.fail() || (chunk_pos.start + padded_chunk_data_size > start + padded_max_data_size)) {
-            ss << "less data available as claimed in chunk \"" << chunk_id << "\" => discard it";
+        uint32_t chunk_id = read_fourcc(chunk_header);
+        uint32_t chunk_data_size;
+        memcpy(&chunk_data_size, chunk_header + 4, sizeof(chunk_data_size));
+        uintmax_t padded_chunk_data_size = pad_data_size(chunk_data_size);
+
+        ChunkPosition chunk_pos = {position + chunk_header_size, chunk_data_size};
+        // check if enough data is available as claimed by the chunk
+        // and also if the chunk claims to reach beyond the padded max_data_size
+        if (chunk_data_size > file.size() - chunk_pos.start || chunk_pos.start + padded_chunk_data_size > end) {
+            ss << "less data available as claimed in chunk \"" << fourcc_to_string(chunk_id) << "\" => discard it";
             break;
         }
         // only if the claimed data is really there consider the chunk valid
         // an add it to the chunk_positions
-        if (chunk_positions.count(chunk_id)) {
-            ss << "multiple \"" << chunk_id << "\" chunks found, using the latest one. ";
-        }
-        chunk_positions[chunk_id] = chunk_pos;
-
-        // now forward by the number of padding bytes plus 1 to set the pointer to the beginning of the next chunk
-        // adding 1 is needed since the pointer currently points to the last byte of the current data block,
-        // not one position behind it
-        file.seekg(padded_chunk_data_size - chunk_data_size + 1, ios_base::cur);
-        file.peek();  // if peeking the next byte just sets the eofbit without setting the failbit or badbit
-                      // the file does not extend beyond the chunk with some unexpected data
-                      // the same is true if the end of the chunk id identical with the max_data_size
-                      // => break the loop gracefully
-        if ((file.eof() && !file.fail())
-            || (chunk_pos.start + padded_chunk_data_size == start + padded_max_data_size)) {
-            long long a = chunk_pos.start + padded_chunk_data_size;
-            long long b = start + padded_max_data_size;
+        if (chunk_positions.contains(chunk_id)) {
+            ss << "multiple \"" << fourcc_to_string(chunk_id) << "\" chunks found, using the latest one. ";
+        }
+        chunk_positions.insert_or_assign(chunk_id, chunk_pos);
+
+        // the next chunk starts behind the padding bytes
+        // if the file or the max_data_size ends there then the file does not extend beyond the chunk with
+        // some unexpected data => break the loop gracefully
+        position = chunk_pos.start + padded_chunk_data_size;
+        if (position >= file.size() || position == end) {
             break;
         }
     }
@@ -136,7 +209,7 @@ static tuple<ChunkPositionMap, string> read_all_chunks(ifstream &file, const str
 
 /*!
  * Checks if the passed chunks contain a chunk with FOURCC chunk_name_fourcc
- * and if at the very beginning of the data block the FOURCC format_type_fourcc is stored
+ * and if at the very beginning of the data block the FOURCC format_type_fourcc is stored (unless it is 0)
  * If yes try to interpret the residual data block as a list of sub-chunks
  * If that fails return an empty ChunkPositionMap together with an error string
  * Returns a tuple of:
@@ -146,41 +219,43 @@ static tuple<ChunkPositionMap, string> read_all_chunks(ifstream &file, const str
  *     - string: is empty if everything went fine, otherwise it contains a warning or error message.
  */
 static tuple<ChunkPositionMap, string> is_chunk_with_format_type_and_subchunks_present(
-    ifstream &file, const ChunkPositionMap &chunks, const std::string &chunk_name_fourcc,
-    const std::string &format_type_fourcc = std::string()) {
-    ChunkPositionMap riff_sub_chunks;
-    ostringstream    ss;
-    if (!chunks.count(chunk_name_fourcc)) {
-        ss << "No " << chunk_name_fourcc << " chunk found";
+    InputFile &file, const ChunkPositionMap &chunks, const uint32_t chunk_name_fourcc,
+    const uint32_t format_type_fourcc = 0) {
+    ChunkPositionMap     riff_sub_chunks;
+    ostringstream        ss;
+    const ChunkPosition *riff_chunk = chunks.find(chunk_name_fourcc);
+    if (!riff_chunk) {
+        ss << "No " << fourcc_to_string(chunk_name_fourcc) << " chunk found";
         return make_tuple(riff_sub_chunks, ss.str());
     }
-    const ChunkPosition &riff_chunk = chunks.find(chunk_name_fourcc)->second;
-    file.seekg(riff_chunk.start);
 
     size_t size_of_format_type = 0;
-    if (!format_type_fourcc.empty()) {
-        char format_raw[4];
-        size_of_format_type = sizeof(format_raw);
-        file.read(format_raw, sizeof(format_raw));
-        string format(format_raw, sizeof(format_raw));
+    if (format_type_fourcc) {
+        size_of_format_type = 4;
+        if (riff_chunk->data_size < size_of_format_type) {
+            ss << "\"" << fourcc_to_string(chunk_name_fourcc) << "\" chunk too small to contain a format type";
+            return make_tuple(riff_sub_chunks, ss.str());
+        }
+        uint32_t format = read_fourcc(file.view(riff_chunk->start, size_of_format_type));
         if (format != format_type_fourcc) {
-            ss << "unsupported format \"" << format << "\" specifier instead of \"" << format_type_fourcc
-               << "\"; try to ";
+            ss << "unsupported format \"" << fourcc_to_string(format) << "\" specifier instead of \""
+               << fourcc_to_string(format_type_fourcc) << "\"; try to ";
             return make_tuple(riff_sub_chunks, ss.str());
         }
     }
-    return read_all_chunks(file, file.tellg(), riff_chunk.data_size - size_of_format_type);
+    return read_all_chunks(file, riff_chunk->start + size_of_format_type,
+                           riff_chunk->data_size - size_of_format_type);
 }
 
 /*! Checks if the chunks contain a valid "LIST" chunk of fomrmat type "INFO", extract its sub-chunks containing the
  *  meta data and adds them to the passed meta_info_chunks. In case a certain sub-chunk is already present in
- *  meta_info_chunks it is overwritten with the new one
+ *  meta_info_chunks the one already present is kept
  */
-void aggregate_meta_data(ifstream &infile, ChunkPositionMap &chunks, ChunkPositionMap &meta_info_chunks,
-                         const std::string &chunk_fourcc, const std::string &format_type_fourcc = std::string()) {
+void aggregate_meta_data(InputFile &infile, ChunkPositionMap &chunks, ChunkPositionMap &meta_info_chunks,
+                         const uint32_t chunk_fourcc, const uint32_t format_type_fourcc = 0) {
     auto const &[new_meta_info_chunks, message] =
         is_chunk_with_format_type_and_subchunks_present(infile, chunks, chunk_fourcc, format_type_fourcc);
-    meta_info_chunks.insert(new_meta_info_chunks.begin(), new_meta_info_chunks.end());
+    meta_info_chunks.insert(new_meta_info_chunks);
 }
 
 /*!
@@ -312,38 +387,41 @@ static tuple<bool, string> check_sane_pcm_or_ieee_float_format_header(const Form
  *           on failure:    tuple(false, <undefined format_header>,
  *                                <undefined ChunkPosition object>, <error_message>)
  */
-static tuple<bool, FormatHeaderExtensible, ChunkPosition, string> is_valid_wav_file(ifstream &        file,
+static tuple<bool, FormatHeaderExtensible, ChunkPosition, string> is_valid_wav_file(InputFile &       file,
                                                                                     ChunkPositionMap &chunk_positions) {
     stringstream           ss;
     FormatHeaderExtensible format_header;
     ChunkPosition          data_chunk_payload;
     // check first if there is a "fmt " chunk
-    if (!chunk_positions.count("fmt ")) {
+    const ChunkPosition *format_chunk = chunk_positions.find(fourcc("fmt "));
+    if (!format_chunk) {
         ss << "no \"fmt \" chunk found";
         return make_tuple(false, format_header, data_chunk_payload, ss.str());
     }
     // then make sure there is a data chunk
-    if (!chunk_positions.count("data")) {
+    const ChunkPosition *data_chunk = chunk_positions.find(fourcc("data"));
+    if (!data_chunk) {
         ss << "no \"data\" chunk found";
         return make_tuple(false, format_header, data_chunk_payload, ss.str());
     }
-    auto size      = sizeof(format_header);
-    auto data_size = chunk_positions["fmt "].data_size;
     // and if it contains enough data to be the format header we expect
-    if (chunk_positions["fmt "].data_size < sizeof(FormatHeader)) {
+    if (format_chunk->data_size < sizeof(FormatHeader)) {
         ss << "not enough bytes to read the base format header";
         return make_tuple(false, format_header, data_chunk_payload, ss.str());
     }
-    // then move pointer to start of data
-    // and read it into the FormatHeader struct
-    file.seekg(chunk_positions["fmt "].start);
-    file.read((char *)&format_header.header, sizeof(format_header.header));
+    // then copy the start of data into the FormatHeader struct
+    // the presence of the data has already been checked by read_all_chunks()
+    memcpy(&format_header.header, file.view(format_chunk->start, sizeof(format_header.header)),
+           sizeof(format_header.header));
     if (format_header.header.audio_format == WAVE_FORMAT_EXTENSIBLE) {
-        if (chunk_positions["fmt "].data_size < sizeof(FormatHeaderExtensible)) {
+        if (format_chunk->data_size < sizeof(FormatHeaderExtensible)) {
             ss << "not enough bytes to read the extensible part of the format header";
             return make_tuple(false, format_header, data_chunk_payload, ss.str());
         }
-        file.read((char *)&format_header.size, sizeof(FormatHeaderExtensible) - sizeof(FormatHeader));
+        memcpy(&format_header.size,
+               file.view(format_chunk->start + sizeof(FormatHeader),
+                         sizeof(FormatHeaderExtensible) - sizeof(FormatHeader)),
+               sizeof(FormatHeaderExtensible) - sizeof(FormatHeader));
     }
     auto [is_header_valid, info_string] = check_sane_pcm_or_ieee_float_format_header(format_header);
     if (!is_header_valid) {
@@ -353,7 +431,7 @@ static tuple<bool, FormatHeaderExtensible, ChunkPosition, string> is_valid_wav_f
     // with PCM content
     // so return the validated FormatHeader structure and the position and length
     // of the PCM data in the stream in a ChunkPosition structure
-    return make_tuple(true, format_header, chunk_positions["data"], info_string);
+    return make_tuple(true, format_header, *data_chunk, info_string);
 }
 
 /*!
@@ -378,7 +456,7 @@ static string get_path_relative_to_top_level(const fs::path &in_file_name) {
 }
 
 /*!
- *  Creates the MP3 file and associates it with the passed stream "out_file".
+ *  Creates the MP3 file and returns it in the passed "out_file".
  *  The path of the MP3 file is generated using the following rules:
  *     - if in_file_name has a ".wav" file ending replace it by ".mp3",
  *       if not then just add ".mp3"
@@ -389,13 +467,13 @@ static string get_path_relative_to_top_level(const fs::path &in_file_name) {
  *       if that file already exists
  *       then use "<mp3_pathname_base> (2).mp3" and so on
  *  if successful:
- *       - "out_file" is a valid open stream
+ *       - "out_file" is a valid open OutputFile
  *       - return: tuple(true, <conversion info string>)
  *         where <conversion info string> has the form:
  *           line 1 (if the case) :     "WARNING: <in_file_name> does not end with .wav.\n"
  *           line 2               :     "<relative path of in_file_name> (<in_file_info>) -> <basename of in_file_name
  **(<n>).mp3
- *       - on failure: "out_file" is closed and invalid
+ *       - on failure: "out_file" is nullptr
  *       - return: tuple(false, <error message string>)
  *  examples for <conversion info string>:
  *  1. Precondition: "wav_folder\test.mp3" does not exist
@@ -414,10 +492,10 @@ static string get_path_relative_to_top_level(const fs::path &in_file_name) {
  *                                 \"test._wav_\" (41.0 kHz, 16 bit, stereo) -> \"test._wav_.mp3\"
  */
 static tuple<bool, string> open_output_stream(const fs::path &in_file_name, const string &in_file_info,
-                                              ofstream &out_file, fs::path &mp3_path) {
+                                              shared_ptr<OutputFile> &out_file, fs::path &mp3_path) {
     ostringstream ss;
     ostringstream status_line;
-    out_file.close();  // just in case there is still a file associated to this stream
+    out_file = nullptr;
     fs::path mp3_path_base;
     if (case_insensitive_compare(in_file_name.extension().string(), ".wav")) {
         mp3_path_base = in_file_name.parent_path() / in_file_name.stem();
@@ -428,6 +506,10 @@ static tuple<bool, string> open_output_stream(const fs::path &in_file_name, cons
         mp3_path_base = in_file_name;
     }
     // Now generate a path for the output file which does not already exist
+    // Since the files are probed in parallel, finding the name and creating the file must not be interrupted
+    // by another thread, e.g. "x.wav" and "x.aiff" passed with -a/--all would both get "x.mp3" otherwise
+    static pthread::mutex                create_mutex;
+    pthread::unique_lock<pthread::mutex> lock(create_mutex);
     // fs::path mp3_path;
     try {
         // try all filename from
@@ -445,13 +527,12 @@ static tuple<bool, string> open_output_stream(const fs::path &in_file_name, cons
             // then do not care if the file already exists
             // otherwise insist that the file does not already exist
             if (Configuration::overwrite_existing_mp3() || !fs::exists(mp3_path)) {
-                // try to open it with the passed ofstream object
-                out_file.open(mp3_path, ios::binary | ios::trunc | ios::out);
+                // try to create it using the configured way of writing
+                out_file = OutputFile::create(mp3_path, Configuration::output_backend());
                 // on failure abort. Most likely the process has no write permissions
-                if (out_file.fail()) {
+                if (!out_file) {
                     ss << "creating \"" << mp3_path.string() << "\" for writing";
                     ss << " failed. Check write permission of target directory";
-                    out_file.clear();
                     return make_tuple(false, ss.str());
                 }
                 // opening worked, so break the name finding loop
@@ -465,7 +546,7 @@ static tuple<bool, string> open_output_stream(const fs::path &in_file_name, cons
         ss << "finding a suitable output file name failed: " << e.code().message();
         return make_tuple(false, ss.str());
     }
-    if (!out_file.is_open()) {
+    if (!out_file) {
         ss << "finding output file name failed.";
         return make_tuple(false, ss.str());
     }
@@ -490,55 +571,61 @@ static void print_error(const string &message, const string &error) {
 };
 
 // adds all id3 v2 tags for which corresponding info chunks are present in the passed meta_data
-static void create_id3_v2_tags(LameInit &lame_guard, shared_ptr<ifstream> in, const ChunkPositionMap &meta_data) {
+static void create_id3_v2_tags(LameInit &lame_guard, shared_ptr<InputFile> in, const ChunkPositionMap &meta_data) {
     // template lambda function (see auto keyword in front of (*setter) requires C++ 14)
-    auto set_tag = [&lame_guard, in, &meta_data](auto (*setter)(lame_t, const char *), string list_info_fourcc) {
-        if (!meta_data.count(list_info_fourcc)) {
+    auto set_tag = [&lame_guard, in, &meta_data](auto (*setter)(lame_t, const char *), uint32_t list_info_fourcc) {
+        const ChunkPosition *tag_chunk = meta_data.find(list_info_fourcc);
+        if (!tag_chunk) {
             return;
         }
-        // use this rather annoying syntax to access the element instead of
-        // just meta_data.find(list_info_fourcc)
-        auto start     = meta_data.find(list_info_fourcc)->second.start;
-        auto data_size = meta_data.find(list_info_fourcc)->second.data_size;
-        in->seekg(start);
-        unique_ptr<char> tag_string_raw(new char[data_size]);
-        in->read(tag_string_raw.get(), data_size);
-        if (strlen(tag_string_raw.get()) >= (std::size_t)data_size) {
+        auto start     = tag_chunk->start;
+        auto data_size = tag_chunk->data_size;
+        auto tag_string_raw = (const char *)in->view(start, data_size);
+        if (!tag_string_raw || !memchr(tag_string_raw, '\0', data_size)) {
             // if the chunk data does not contain a null byte to mark a null terminated string
             // consider the tag invalid and just silently ignore it
             return;
         }
         // leave this debug code in for now
         //ostringstream ss;
-        //ss << list_info_fourcc << ": " << tag_string_raw.get() << endl;
+        //ss << fourcc_to_string(list_info_fourcc) << ": " << tag_string_raw << endl;
         //tcout << ss.str();
-        setter(lame_guard, tag_string_raw.get());
+        setter(lame_guard, tag_string_raw);
     };
     id3tag_init(lame_guard);
     id3tag_v2_only(lame_guard); // do not support ancient outdated id3 v1 tags by purpose
 
-    set_tag(id3tag_set_title, "INAM");
-    set_tag(id3tag_set_artist, "IART");
-    set_tag(id3tag_set_album, "IMED");
-    set_tag(id3tag_set_year, "ICRD");
+    set_tag(id3tag_set_title, fourcc("INAM"));
+    set_tag(id3tag_set_artist, fourcc("IART"));
+    set_tag(id3tag_set_album, fourcc("IMED"));
+    set_tag(id3tag_set_year, fourcc("ICRD"));
     // several tags found which claim to mark comments
     // assume that only one will be present
     // if more are present the ICMT one takes precedence
-    set_tag(id3tag_set_comment, "COMM");
-    set_tag(id3tag_set_comment, "CMNT");
-    set_tag(id3tag_set_comment, "ICMT");
+    set_tag(id3tag_set_comment, fourcc("COMM"));
+    set_tag(id3tag_set_comment, fourcc("CMNT"));
+    set_tag(id3tag_set_comment, fourcc("ICMT"));
     // also more than one ID for genre found
-    set_tag(id3tag_set_track, "TRCK");
-    set_tag(id3tag_set_track, "ITRK");
+    set_tag(id3tag_set_track, fourcc("TRCK"));
+    set_tag(id3tag_set_track, fourcc("ITRK"));
     // also more than one ID for genre found
-    set_tag(id3tag_set_genre, "GENR");
-    set_tag(id3tag_set_genre, "IGNR");
+    set_tag(id3tag_set_genre, fourcc("GENR"));
+    set_tag(id3tag_set_genre, fourcc("IGNR"));
 }
 
+// what an encoder configured by config_lame() encodes
+// The segments of a file encoded in parallel are joined into one stream, so only the first one writes the id3 v2
+// tags and the VBR tag frame, like the encoder of a whole file does. All segments encode without the bit reservoir,
+// so that every MP3 frame carries its own data and the streams can be cut and joined at any MP3 frame, see
+// convert_file_in_segments(). This costs some quality at the same bit rate, which is why files are only split into
+// segments if requested by --segment-seconds
+enum class EncoderRole { whole_file, first_segment, next_segment };
+
 // calls the config functions of lame according to the content of the header
 // and the encoding quality returned by Configuration::encoding_quality()
-static bool config_lame(LameInit &lame_guard, shared_ptr<ifstream> &in, const string &message,
-                        const FormatHeader &header, const ChunkPositionMap &list_info_chunk_meta_data) {
+static bool config_lame(LameInit &lame_guard, shared_ptr<InputFile> &in, const string &message,
+                        const FormatHeader &header, const ChunkPositionMap &list_info_chunk_meta_data,
+                        const EncoderRole role = EncoderRole::whole_file) {
     if (!lame_guard.is_initialized()) {
         string error = "lame_init() failed";
         print_error(message, error);
@@ -546,7 +633,17 @@ static bool config_lame(LameInit &lame_guard, shared_ptr<ifstream> &in, const st
     }
     int res = 0;
     try {
-        create_id3_v2_tags(lame_guard, in, list_info_chunk_meta_data);
+        if (role != EncoderRole::next_segment) {
+            create_id3_v2_tags(lame_guard, in, list_info_chunk_meta_data);
+        }
+        if (role == EncoderRole::next_segment) {
+            res = lame_set_bWriteVbrTag(lame_guard, 0);
+            LameInit::check_error(res, "lame_set_bWriteVbrTag");
+        }
+        if (role != EncoderRole::whole_file) {
+            res = lame_set_disable_reservoir(lame_guard, 1);
+            LameInit::check_error(res, "lame_set_disable_reservoir");
+        }
         res = lame_set_num_channels(lame_guard, header.num_channels);
         LameInit::check_error(res, "lame_set_num_channels");
         res = lame_set_in_samplerate(lame_guard, header.samples_per_second);
@@ -564,100 +661,262 @@ static bool config_lame(LameInit &lame_guard, shared_ptr<ifstream> &in, const st
     return true;
 }
 
-// helper function for convert_file_worker() for converting the next num_of_samples  audio samples of a WAV file in PCM
-// format
-void convert_pcm_int_chunk(LameInit &lame_guard, std::shared_ptr<std::ifstream> &in,
-                           std::shared_ptr<std::ofstream> &out, const uint32_t number_of_samples,
-                           const uint32_t bytes_per_sample, const FormatHeaderExtensible &header_extensible) {
-    uint32_t    valid_bits_per_sample;
-    auto const &header = header_extensible.header;
-    if (header.audio_format == WAVE_FORMAT_EXTENSIBLE) {
-        valid_bits_per_sample = header_extensible.samples.valid_bits_per_sample;
-    } else {
-        valid_bits_per_sample = header.bits_per_sample;
+// helper function for convert_pcm_int_chunk() and convert_ieee_float_chunk() returning a view on the block_size bytes
+// of audio data starting at file offset "position" of "in"
+// throws a runtime_error if less data than requested is available
+static const byte *view_block(InputFile &in, const uintmax_t position, const size_t block_size) {
+    const byte *block = nullptr;
+    {
+        ActivityTimer timer(WorkerActivity::io);
+        block = in.view(position, block_size);
+        // views into a mapping are only read when accessed, which would be measured as encoding
+        // Without a ConcurrencyController nothing is measured, so the kernel is left reading ahead meanwhile
+        if (block && timer.measuring()) {
+            in.touch(position, block_size);
+        }
+    }
+    if (!block) {
+        ostringstream err;
+        err << "unexpected error: reading " << block_size << " bytes of audio data at offset " << position
+            << " failed";
+        throw runtime_error(err.str());
     }
-    unique_ptr<int32_t> pcm_buffer(new int32_t[number_of_samples]);
+    return block;
+}
+
+// signature of the functions converting the number_of_samples audio samples of a WAV file starting at file offset
+// "position", see select_convert_chunk_function()
+typedef void (*ConvertChunkFunction)(LameInit &lame_guard, InputFile &in, const std::uintmax_t position,
+                                     OutputFile &out, const uint32_t number_of_samples,
+                                     const uint32_t valid_bits_per_sample);
+
+// helper function for the convert_..._chunk() functions passing number_of_samples samples to the lame encoding function
+// matching the sample type and the number of channels and writing the encoded MP3 data to "out"
+// Both are known at compile time, so the matching lame function is chosen by the compiler
+template <typename Sample, uint16_t num_channels>
+static void encode_samples(LameInit &lame_guard, const Sample *pcm_buffer, const uint32_t number_of_samples,
+                           OutputFile &out) {
     // formula found in the documentation of "lame_encode_buffer" in lame.h
-    uint32_t                  mp3_buffer_size = (uint32_t)(1.25 * (double)number_of_samples + 7200.0);
-    unique_ptr<unsigned char> mp3_buffer(new unsigned char[mp3_buffer_size]);
-    for (uint32_t i = 0; i < number_of_samples; i++) {
-        int32_t c = 0;
-        in->read((char *)&c, bytes_per_sample);
-        if (bytes_per_sample == 1) {
-            c -= 128;
-        }
-        c <<= (sizeof(int32_t) * 8 - valid_bits_per_sample);  // expands values to the full range of int32_t
-        pcm_buffer.get()[i] = c;
-    }
-    int bytes_converted = 0;
-    if (header.num_channels == 2) {
-        bytes_converted = lame_encode_buffer_interleaved_int(lame_guard, pcm_buffer.get(), number_of_samples / 2,
-                                                             mp3_buffer.get(), mp3_buffer_size);
-        LameInit::check_error(bytes_converted, "lame_encode_buffer_interleaved_int");
-    } else {
-        bytes_converted = lame_encode_buffer_int(lame_guard, pcm_buffer.get(), 0, number_of_samples, mp3_buffer.get(),
-                                                 mp3_buffer_size);
-        LameInit::check_error(bytes_converted, "lame_encode_buffer_int");
+    uint32_t       mp3_buffer_size = (uint32_t)(1.25 * (double)number_of_samples + 7200.0);
+    BufferArena &  arena           = BufferArena::of_current_thread();
+    unsigned char *mp3_buffer      = arena.get<unsigned char>(BufferSlot::mp3_data, mp3_buffer_size);
+    int            bytes_converted = 0;
+    // the times spent in lame and writing are compared for adapting the number of threads, see ConcurrencyController
+    {
+        ActivityTimer timer(WorkerActivity::encoding);
+        if constexpr (is_same_v<Sample, int32_t> && num_channels == 2) {
+            bytes_converted = lame_encode_buffer_interleaved_int(lame_guard, pcm_buffer, number_of_samples / 2,
+                                                                 mp3_buffer, mp3_buffer_size);
+            LameInit::check_error(bytes_converted, "lame_encode_buffer_interleaved_int");
+        } else if constexpr (is_same_v<Sample, int32_t>) {
+            bytes_converted =
+                lame_encode_buffer_int(lame_guard, pcm_buffer, 0, number_of_samples, mp3_buffer, mp3_buffer_size);
+            LameInit::check_error(bytes_converted, "lame_encode_buffer_int");
+        } else if constexpr (is_same_v<Sample, float> && num_channels == 2) {
+            bytes_converted = lame_encode_buffer_interleaved_ieee_float(lame_guard, pcm_buffer, number_of_samples / 2,
+                                                                        mp3_buffer, mp3_buffer_size);
+            LameInit::check_error(bytes_converted, "lame_encode_buffer_interleaved_ieee_float");
+        } else if constexpr (is_same_v<Sample, float>) {
+            bytes_converted = lame_encode_buffer_ieee_float(lame_guard, pcm_buffer, 0, number_of_samples,
+                                                            mp3_buffer, mp3_buffer_size);
+            LameInit::check_error(bytes_converted, "lame_encode_buffer_ieee_float");
+        } else if constexpr (is_same_v<Sample, double> && num_channels == 2) {
+            bytes_converted = lame_encode_buffer_interleaved_ieee_double(lame_guard, pcm_buffer, number_of_samples / 2,
+                                                                         mp3_buffer, mp3_buffer_size);
+            LameInit::check_error(bytes_converted, "lame_encode_buffer_interleaved_ieee_double");
+        } else {
+            static_assert(is_same_v<Sample, double>, "unsupported sample type");
+            bytes_converted = lame_encode_buffer_ieee_double(lame_guard, pcm_buffer, 0, number_of_samples,
+                                                             mp3_buffer, mp3_buffer_size);
+            LameInit::check_error(bytes_converted, "lame_encode_buffer_ieee_double");
+        }
     }
-    out->write((char *)mp3_buffer.get(), bytes_converted);
+    ActivityTimer timer(WorkerActivity::io);
+    out.write(mp3_buffer, bytes_converted);
+}
+
+// helper function for convert_audio_data() for converting the next num_of_samples  audio samples of a WAV file in PCM
+// format with samples stored in containers of bytes_per_sample bytes
+template <uint32_t bytes_per_sample, uint16_t num_channels>
+static void convert_pcm_int_chunk(LameInit &lame_guard, InputFile &in, const std::uintmax_t position,
+                                  OutputFile &out, const uint32_t number_of_samples,
+                                  const uint32_t valid_bits_per_sample) {
+    int32_t *pcm_buffer = BufferArena::of_current_thread().get<int32_t>(BufferSlot::pcm_samples, number_of_samples);
+    // get the whole block of samples at once instead of reading sample by sample
+    // and unpack the samples from memory afterwards
+    const byte *raw = view_block(in, position, (size_t)number_of_samples * bytes_per_sample);
+    // expands values to the full range of int32_t
+    unpack_pcm_int_samples((const char *)raw, pcm_buffer, number_of_samples, bytes_per_sample, valid_bits_per_sample);
+    encode_samples<int32_t, num_channels>(lame_guard, pcm_buffer, number_of_samples, out);
 }
 
-// helper function for convert_file_worker() for converting the next num_of_samples  audio samples of a WAV file in IEEE
+// helper function for convert_audio_data() for converting the next num_of_samples  audio samples of a WAV file in IEEE
 // FLOAT format
-void convert_ieee_float_chunk(LameInit &lame_guard, std::shared_ptr<std::ifstream> &in,
-                              std::shared_ptr<std::ofstream> &out, const uint32_t number_of_samples,
-                              const uint32_t bytes_per_sample, const FormatHeader &header) {
-    unique_ptr<double> pcm_buffer(new double[number_of_samples]);
-    // formula found in the documentation of "lame_encode_buffer" in lame.h
-    uint32_t                  mp3_buffer_size = (uint32_t)(1.25 * (double)number_of_samples + 7200.0);
-    unique_ptr<unsigned char> mp3_buffer(new unsigned char[mp3_buffer_size]);
-    for (uint32_t i = 0; i < number_of_samples; i++) {
-        double c = 0;
+// lame accepts both 32 bit float and 64 bit double samples, so the block of samples in the file
+// is handed over to lame as it is without any conversion
+template <typename Sample, uint16_t num_channels>
+static void convert_ieee_float_chunk(LameInit &lame_guard, InputFile &in, const std::uintmax_t position,
+                                     OutputFile &out, const uint32_t number_of_samples,
+                                     const uint32_t /* valid_bits_per_sample, all bits of floats are valid */) {
+    const byte *raw = view_block(in, position, (size_t)number_of_samples * sizeof(Sample));
+    // chunks are only aligned to 2 bytes, so a view into a memory mapped file may not be suitably aligned
+    // for Sample. Only in this case copy the samples into an aligned buffer
+    if ((uintptr_t)raw % alignof(Sample) == 0) {
+        encode_samples<Sample, num_channels>(lame_guard, (const Sample *)raw, number_of_samples, out);
+        return;
+    }
+    Sample *pcm_buffer = BufferArena::of_current_thread().get<Sample>(BufferSlot::float_samples, number_of_samples);
+    memcpy(pcm_buffer, raw, (size_t)number_of_samples * sizeof(Sample));
+    encode_samples<Sample, num_channels>(lame_guard, pcm_buffer, number_of_samples, out);
+}
+
+// helper function for select_convert_chunk_function() returning the conversion function
+// for the sample format and the number of channels num_channels
+template <uint16_t num_channels>
+static ConvertChunkFunction select_convert_chunk_function(const bool is_ieee_float, const uint32_t bytes_per_sample) {
+    if (is_ieee_float) {
         switch (bytes_per_sample) {
-            case 4:
-                float f;
-                in->read((char *)&f, sizeof(float));
-                c = f;  // convert float to double
-                break;
-            case 8:
-                in->read((char *)&c, sizeof(double));
-                break;
-            default:
-                ostringstream err;
-                err << "unexpected error: illegal bits per sample value " << header.bits_per_sample
-                    << " for \"IEEE FLOAT\" format";
-                throw runtime_error(err.str());
-        }
-        pcm_buffer.get()[i] = c;
-    }
-    int bytes_converted = 0;
-    if (header.num_channels == 2) {
-        bytes_converted = lame_encode_buffer_interleaved_ieee_double(
-            lame_guard, pcm_buffer.get(), number_of_samples / 2, mp3_buffer.get(), mp3_buffer_size);
-        LameInit::check_error(bytes_converted, "lame_encode_buffer_interleaved_ieee_double");
-    } else {
-        bytes_converted = lame_encode_buffer_ieee_double(lame_guard, pcm_buffer.get(), 0, number_of_samples,
-                                                         mp3_buffer.get(), mp3_buffer_size);
-        LameInit::check_error(bytes_converted, "lame_encode_buffer_ieee_double");
+            case sizeof(float):
+                return convert_ieee_float_chunk<float, num_channels>;
+            case sizeof(double):
+                return convert_ieee_float_chunk<double, num_channels>;
+        }
+        return nullptr;
+    }
+    switch (bytes_per_sample) {
+        case 1:
+            return convert_pcm_int_chunk<1, num_channels>;
+        case 2:
+            return convert_pcm_int_chunk<2, num_channels>;
+        case 3:
+            return convert_pcm_int_chunk<3, num_channels>;
+        case 4:
+            return convert_pcm_int_chunk<4, num_channels>;
+    }
+    return nullptr;
+}
+
+/*!
+ * Selects the function for converting the chunks of audio samples once per file
+ * from the validated header_extensible, so that the conversion of the chunks itself does not need to check the format
+ * again. Also determines the number of valid bits per sample to pass to that function.
+ * Throws a runtime_error if the format is not supported, which should have been checked
+ * by check_sane_pcm_or_ieee_float_format_header() before
+ */
+static tuple<ConvertChunkFunction, uint32_t> select_convert_chunk_function(
+    const FormatHeaderExtensible &header_extensible) {
+    auto const &header           = header_extensible.header;
+    uint32_t    bytes_per_sample = (header.bits_per_sample + 7) / 8;
+    bool        is_pcm           = header.audio_format == WAVE_FORMAT_PCM
+                      || (header.audio_format == WAVE_FORMAT_EXTENSIBLE
+                          && header_extensible.sub_format == KSDATAFORMAT_SUBTYPE_PCM);
+    bool is_ieee_float = header.audio_format == WAVE_FORMAT_IEEE_FLOAT
+                         || (header.audio_format == WAVE_FORMAT_EXTENSIBLE
+                             && header_extensible.sub_format == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT);
+    if (!(is_pcm || is_ieee_float)) {
+        set_return_code(RET_CODE_CONVERTING_SOME_FILES_FAILED);
+        throw runtime_error("unexpected error: unsupported audio format. Should have been checked by "
+                            "check_sane_pcm_or_ieee_float_format_header()");
+    }
+    uint32_t valid_bits_per_sample = header.bits_per_sample;
+    if (header.audio_format == WAVE_FORMAT_EXTENSIBLE && is_pcm) {
+        valid_bits_per_sample = header_extensible.samples.valid_bits_per_sample;
+    }
+    if (is_pcm && (valid_bits_per_sample < 1 || valid_bits_per_sample > 8 * bytes_per_sample)) {
+        ostringstream err;
+        err << "unexpected error: illegal bits per sample value " << header.bits_per_sample << " ("
+            << valid_bits_per_sample << " valid bits) for \"PCM\" format";
+        throw runtime_error(err.str());
+    }
+    ConvertChunkFunction convert_chunk = nullptr;
+    switch (header.num_channels) {
+        case 1:
+            convert_chunk = select_convert_chunk_function<1>(is_ieee_float, bytes_per_sample);
+            break;
+        case 2:
+            convert_chunk = select_convert_chunk_function<2>(is_ieee_float, bytes_per_sample);
+            break;
+    }
+    if (!convert_chunk) {
+        ostringstream err;
+        err << "unexpected error: illegal bits per sample value " << header.bits_per_sample << " for "
+            << header.num_channels << " channels in \"" << (is_pcm ? "PCM" : "IEEE FLOAT") << "\" format";
+        throw runtime_error(err.str());
+    }
+    return make_tuple(convert_chunk, valid_bits_per_sample);
+}
+
+// estimates the size of the MP3 file from the duration of the audio data and the bit rate lame has been configured
+// with. Overestimating does not harm, since a preallocated file is truncated to its real size after encoding
+static uintmax_t estimate_mp3_size(LameInit &lame_guard, const FormatHeader &header, const uintmax_t data_size) {
+    if (header.bytes_per_second == 0) {
+        return 0;
+    }
+    // reserve one additional second for the frames added by the encoder and for the id3 v2 tags
+    uintmax_t duration_in_seconds = data_size / header.bytes_per_second + 1;
+    int       bit_rate_kbps       = lame_get_VBR(lame_guard) == vbr_off ? lame_get_brate(lame_guard)
+                                                                  : lame_get_VBR_max_bitrate_kbps(lame_guard);
+    return duration_in_seconds * (uintmax_t)(bit_rate_kbps > 0 ? bit_rate_kbps : 320) * 1000 / 8;
+}
+
+// number of audio frames converted at once by convert_audio_data()
+static const uint32_t max_number_of_frames_in_a_chunk = 8192;
+
+// converts the "data_size" bytes of audio data starting at file offset "position" of "in" using the encoder
+// "lame_guard" and writes the MP3 data to "out"
+// returns false if the conversion has been aborted since the user pressed Ctrl-C (SIGINT) or SIGTERM was sent
+static bool convert_audio_data(LameInit &lame_guard, InputFile &in, OutputFile &out,
+                               const FormatHeaderExtensible &header_extensible, uintmax_t position,
+                               const uintmax_t data_size) {
+    const FormatHeader &header = header_extensible.header;
+    // select the function for converting the chunks matching the sample format only once
+    auto [convert_chunk, valid_bits_per_sample] = select_convert_chunk_function(header_extensible);
+
+    uint32_t  max_number_of_samples_in_a_chunk = max_number_of_frames_in_a_chunk * header.num_channels;
+    uint32_t  bytes_per_sample                 = (header.bits_per_sample + 7) / 8;
+    uintmax_t residual_number_of_samples       = data_size / bytes_per_sample;
+    while (residual_number_of_samples > 0) {
+        uint32_t number_of_samples = residual_number_of_samples > max_number_of_samples_in_a_chunk
+                                         ? max_number_of_samples_in_a_chunk
+                                         : (uint32_t)residual_number_of_samples;
+        convert_chunk(lame_guard, in, position, out, number_of_samples, valid_bits_per_sample);
+        residual_number_of_samples -= number_of_samples;
+        position += (uintmax_t)number_of_samples * bytes_per_sample;
+        in.release_before(position);  // the converted audio data is not needed anymore
+        // check after each converted chunk if the user pressed Ctrl-C (SIGINT) or SIGTERM was sent
+        if (SignalHandler::termination_requested()) {
+            return false;
+        }
     }
-    out->write((char *)mp3_buffer.get(), bytes_converted);
+    return true;
+}
+
+// retrieves the MP3 data still buffered by the encoder "lame_guard" and writes it to "out"
+static void flush_encoder(LameInit &lame_guard, OutputFile &out) {
+    // the size lame_encode_flush() needs at most according to the documentation in lame.h
+    uint32_t       mp3_buffer_size = 7200;
+    unsigned char *mp3_buffer =
+        BufferArena::of_current_thread().get<unsigned char>(BufferSlot::mp3_data, mp3_buffer_size);
+
+    int bytes_converted = lame_encode_flush(lame_guard, mp3_buffer, mp3_buffer_size);
+    LameInit::check_error(bytes_converted, "lame_encode_flush");
+    out.write(mp3_buffer, bytes_converted);
 }
 
 // this function does the actual conversion work and is being executed
 // in one of the threads of the thread pool
 // currently the argument thread_number is not used, but it can be useful to generate debug output
 // containing the thread number, so I leave it in for now
-static void convert_file_worker(shared_ptr<ifstream> in, shared_ptr<ofstream> out, const fs::path out_filename,
+static void convert_file_worker(shared_ptr<InputFile> in, shared_ptr<OutputFile> out, const fs::path out_filename,
                                 const FormatHeaderExtensible header_extensible, const ChunkPosition pcm_data_position,
-                                string message, ChunkPositionMap list_info_chunk_meta_data, uint16_t thread_number) {
+                                string message, ChunkPositionMap list_info_chunk_meta_data,
+                                uint16_t /* thread_number */) {
     // Define a lambda function for discard incomplete mp3 file in case of an error
     auto remove_mp3_file = [&out, &out_filename]() {
         out->close();
         std::error_code ec;
         fs::remove(out_filename, ec);  // try to delete the incomplete MP3 file, but do not make a fuzz about failing
     };
-    // allocate input buffer for 8192 samples with maximum allowed bit size
-    const uint32_t max_number_of_frames_in_a_chunk = 8192;
     try {
         const FormatHeader &header = header_extensible.header;
         LameInit            lame_guard;  // Initializes lame on construction and closes it on destruction
@@ -666,50 +925,25 @@ static void convert_file_worker(shared_ptr<ifstream> in, shared_ptr<ofstream> ou
         if (!config_lame(lame_guard, in, message, header, list_info_chunk_meta_data)) {
             return;
         }
-        // move to stream position where the data starts
-        in->seekg(pcm_data_position.start, ios_base::beg);
-
-        uint32_t max_number_of_samples_in_a_chunk = max_number_of_frames_in_a_chunk * header.num_channels;
-        uint32_t bytes_per_sample                 = (header.bits_per_sample + 7) / 8;
-        uint32_t residual_number_of_samples       = (uint32_t)pcm_data_position.data_size / bytes_per_sample;
-
-        uint32_t number_of_samples = 0;
-        while (residual_number_of_samples > 0) {
-            number_of_samples = residual_number_of_samples > max_number_of_samples_in_a_chunk
-                                    ? max_number_of_samples_in_a_chunk
-                                    : residual_number_of_samples;
-            if (header.audio_format == WAVE_FORMAT_PCM
-                || (header.audio_format == WAVE_FORMAT_EXTENSIBLE
-                    && header_extensible.sub_format == KSDATAFORMAT_SUBTYPE_PCM)) {  // PCM
-                convert_pcm_int_chunk(lame_guard, in, out, number_of_samples, bytes_per_sample, header_extensible);
-            } else if (header.audio_format == WAVE_FORMAT_IEEE_FLOAT
-                       || (header.audio_format == WAVE_FORMAT_EXTENSIBLE
-                           && header_extensible.sub_format == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT)) {  // IEEE_FLOAT
-                convert_ieee_float_chunk(lame_guard, in, out, number_of_samples, bytes_per_sample, header);
-
-            } else {
-                set_return_code(RET_CODE_CONVERTING_SOME_FILES_FAILED);
-                throw runtime_error("unexpected error: unsupported audio format. Should have been checked by "
-                                    "check_sane_pcm_or_ieee_float_format_header()");
-            }
-            residual_number_of_samples -= number_of_samples;
-            // check after each converted chunk if the user pressed Ctrl-C (SIGINT) or SIGTERM was sent
-            if (SignalHandler::termination_requested()) {
-                remove_mp3_file();
-                return;
-            }
+        // let the file system allocate the MP3 file in one piece
+        out->preallocate(estimate_mp3_size(lame_guard, header, pcm_data_position.data_size));
+        // the audio data is read sequentially from the position where the data starts
+        in->advise_sequential(pcm_data_position.start, pcm_data_position.data_size);
+        if (!convert_audio_data(lame_guard, *in, *out, header_extensible, pcm_data_position.start,
+                                pcm_data_position.data_size)) {
+            remove_mp3_file();
+            return;
+        }
+        // now retrieve any lingering mp3 data and write it
+        flush_encoder(lame_guard, *out);
+        if (!out->close()) {
+            throw runtime_error("writing the MP3 file failed");
         }
-        // formula found in the documentation of "lame_encode_buffer" in lame.h
-        uint32_t                  mp3_buffer_size = (uint32_t)(1.25 * (double)number_of_samples + 7200.0);
-        unique_ptr<unsigned char> mp3_buffer(new unsigned char[mp3_buffer_size]);
-
-        // now retrieve any lingering mp3 data into the mp3 buffer and write it
-        int bytes_converted = lame_encode_flush(lame_guard, mp3_buffer.get(), mp3_buffer_size);
-        out->write((char *)mp3_buffer.get(), bytes_converted);
 
         // then report successful completion
         ostringstream ss;
         ss << OK_PREFIX << message << " converted" << endl;
+        number_of_converted_files++;
         tcout << ss.str();
     } catch (const exception &e) {
         print_error(message, e.what());
@@ -720,24 +954,285 @@ static void convert_file_worker(shared_ptr<ifstream> in, shared_ptr<ofstream> ou
     }
 }
 
+// number of MP3 frames a segment is encoded ahead of its start for priming the encoder, see Segment
+static const uint32_t segment_priming_mp3_frames = 8;
+
+// a time segment of a long WAV file encoded by a task of its own, see convert_file_in_segments()
+// A fresh encoder starts with empty filter banks and psychoacoustic model, so a segment is encoded starting
+// a few MP3 frames before its start. The MP3 frames encoded for priming are dropped when joining the segments.
+// Also the encoder needs the audio data following an MP3 frame for encoding it, so a segment is encoded
+// the same number of MP3 frames beyond its end and the MP3 frames encoded from these are dropped as well
+typedef struct Segment {
+    std::uintmax_t    first_sample       = 0;  // first sample (of every channel) passed to the encoder
+    std::uintmax_t    end_sample         = 0;  // sample following the last one passed to the encoder
+    std::size_t       tag_mp3_frames     = 0;  // number of frames preceding the audio data, i.e. the VBR tag frame
+    std::size_t       dropped_mp3_frames = 0;  // number of MP3 frames encoded for priming only
+    std::size_t       kept_mp3_frames    = 0;  // number of MP3 frames of audio data joined, 0 for all up to the end
+    MemoryOutputFile  mp3_data;
+    bool              is_aborted = false;  // the user pressed Ctrl-C (SIGINT) or SIGTERM was sent
+    bool              has_failed = false;  // encoding failed, the reason is in "error" unless already printed
+    std::string       error;
+    TaskGroup         done;
+    MemoryReservation memory;  // reserved for a segment started ahead of the one written next
+} Segment;
+
+// the largest frame of audio data (2 channels of 64 bit float samples) and the lowest sampling rate expected, used
+// for estimating the memory needed for a file not probed yet
+static const uint32_t max_bytes_per_frame    = 2 * sizeof(double);
+static const uint32_t min_samples_per_second = 8000;
+// the highest bit rate of MP3 data (320 kbps) in bytes per second and the most samples of an MP3 frame
+static const uintmax_t max_mp3_bytes_per_second = 320 * 1000 / 8;
+static const uint32_t  max_mp3_frame_samples    = 1152;
+// memory of a task converting a file besides its buffers, like the copies of the meta data bound to it
+static const uintmax_t task_memory = 16 * 1024;
+// memory lame allocates for an encoder, estimated on the safe side
+static const uintmax_t lame_encoder_memory = 512 * 1024;
+
+// returns the memory needed at most for encoding a segment of a WAV file of "file_size" bytes with frames of
+// "block_align" bytes, see MemoryBudget. Besides the buffers for reading the segment its MP3 data is kept in memory
+// until it is written
+static uintmax_t memory_needed_for_segment(const uint32_t block_align, const uint32_t samples_per_second,
+                                           const uintmax_t file_size) {
+    // a segment is encoded with the MP3 frames for priming before and after it, one second is added for the
+    // frames added by the encoder like estimate_mp3_size() does
+    uintmax_t priming_samples = 2 * (uintmax_t)segment_priming_mp3_frames * max_mp3_frame_samples;
+    uint32_t  rate            = max(samples_per_second, 1u);
+    uintmax_t seconds         = Configuration::segment_seconds() + (priming_samples + rate - 1) / rate + 1;
+    return InputFile::memory_needed(Configuration::input_backend(), max_number_of_frames_in_a_chunk * block_align,
+                                    file_size)
+           + seconds * max_mp3_bytes_per_second + task_memory;
+}
+
+// returns the memory needed at most for converting a WAV file of "file_size" bytes with frames of "block_align"
+// bytes, see MemoryBudget. A file split into segments needs the memory for the segment written next as well,
+// the segments started ahead reserve their memory on their own, see convert_file_in_segments()
+static uintmax_t memory_needed_for_file(const uint32_t block_align, const uint32_t samples_per_second,
+                                        const uintmax_t file_size, const bool is_segmented) {
+    uintmax_t memory = InputFile::memory_needed(Configuration::input_backend(),
+                                                max_number_of_frames_in_a_chunk * block_align, file_size)
+                       + OutputFile::memory_needed(Configuration::output_backend()) + task_memory;
+    if (is_segmented) {
+        memory += memory_needed_for_segment(block_align, samples_per_second, file_size);
+    }
+    return memory;
+}
+
+// returns the memory a thread encoding needs at most for its buffers (see BufferArena and encode_samples())
+// and its encoder
+static uintmax_t memory_needed_per_thread() {
+    uintmax_t max_samples = (uintmax_t)max_number_of_frames_in_a_chunk * 2;
+    return max_samples * (sizeof(int32_t) + sizeof(double)) + (uintmax_t)(1.25 * (double)max_samples + 7200.0)
+           + lame_encoder_memory;
+}
+
+// encodes "segment" of the WAV file "in_filename" in one of the threads of the thread pool
+// The file is opened by every segment on its own, since an InputFile must not be read by several threads
+static void encode_segment(const fs::path in_filename, const FormatHeaderExtensible header_extensible,
+                           const ChunkPosition pcm_data_position, const string message,
+                           const ChunkPositionMap list_info_chunk_meta_data, const bool is_first, Segment *segment,
+                           uint16_t /* thread_number */) {
+    try {
+        shared_ptr<InputFile> in = InputFile::open(in_filename, Configuration::input_backend());
+        if (!in) {
+            throw runtime_error("opening the WAV file for encoding a segment failed");
+        }
+        const FormatHeader &header = header_extensible.header;
+        LameInit            lame_guard;
+        if (!config_lame(lame_guard, in, message, header, list_info_chunk_meta_data,
+                         is_first ? EncoderRole::first_segment : EncoderRole::next_segment)) {
+            segment->has_failed = true;  // config_lame() has printed the error already
+            return;
+        }
+        // lame may have turned the VBR tag frame off, e.g. for free format
+        segment->tag_mp3_frames = lame_get_bWriteVbrTag(lame_guard) ? 1 : 0;
+        uint32_t  block_align = (header.bits_per_sample + 7) / 8 * header.num_channels;
+        uintmax_t position    = pcm_data_position.start + segment->first_sample * block_align;
+        uintmax_t data_size   = (segment->end_sample - segment->first_sample) * block_align;
+        in->advise_sequential(position, data_size);
+        if (!convert_audio_data(lame_guard, *in, segment->mp3_data, header_extensible, position, data_size)) {
+            segment->is_aborted = true;
+            return;
+        }
+        flush_encoder(lame_guard, segment->mp3_data);
+    } catch (const exception &e) {
+        segment->has_failed = true;
+        segment->error      = e.what();
+    }
+}
+
+// returns the part of the MP3 data of "segment" which is joined into the MP3 file
+static tuple<size_t, size_t> segment_mp3_data_to_join(const Segment &segment, const bool is_first) {
+    const uint8_t *data = segment.mp3_data.data().data();
+    size_t         size = segment.mp3_data.data().size();
+    // only the first segment starts with the id3 v2 tags and the VBR tag frame, which are kept
+    size_t frames_start = id3v2_tag_size(data, size);
+    size_t audio_start  = skip_mp3_frames(data, size, frames_start, segment.tag_mp3_frames);
+    size_t begin        = is_first ? 0 : skip_mp3_frames(data, size, audio_start, segment.dropped_mp3_frames);
+    size_t end          = size;
+    if (segment.kept_mp3_frames > 0) {
+        end = skip_mp3_frames(data, size, is_first ? audio_start : begin, segment.kept_mp3_frames);
+    }
+    return make_tuple(begin, end);
+}
+
+// like convert_file_worker(), but splits the audio data into segments of Configuration::segment_seconds() which
+// are encoded in parallel by the threads of the pool and joined into one MP3 stream as they are completed
+// Every encoder is fed from the start of an MP3 frame of the encoding of the whole file, so the MP3 frames of
+// all segments lie on the same grid and the encoder delay is that of the first segment only. At most as many
+// segments as there are threads are encoded ahead of the segment written next, limiting the memory needed.
+// With --memory-limit fewer segments are encoded ahead while the memory budget is used up.
+// Files too short for two segments or resampled by lame are converted by convert_file_worker()
+static void convert_file_in_segments(const fs::path in_filename, shared_ptr<InputFile> in, shared_ptr<OutputFile> out,
+                                     const fs::path out_filename, const FormatHeaderExtensible header_extensible,
+                                     const ChunkPosition pcm_data_position, string message,
+                                     ChunkPositionMap list_info_chunk_meta_data, ThreadPool &thread_pool,
+                                     uint16_t thread_number) {
+    auto remove_mp3_file = [&out, &out_filename]() {
+        out->close();
+        std::error_code ec;
+        fs::remove(out_filename, ec);  // try to delete the incomplete MP3 file, but do not make a fuzz about failing
+    };
+    const FormatHeader &header            = header_extensible.header;
+    uint32_t            block_align       = (header.bits_per_sample + 7) / 8 * header.num_channels;
+    uintmax_t           number_of_samples = pcm_data_position.data_size / block_align;
+    uint32_t            mp3_frame_samples = 0;
+    bool                is_resampled      = false;
+    try {
+        // the number of samples of an MP3 frame and the sampling rate of the MP3 data are known only after lame
+        // has been configured
+        LameInit lame_guard;
+        if (!config_lame(lame_guard, in, message, header, list_info_chunk_meta_data, EncoderRole::first_segment)) {
+            remove_mp3_file();
+            return;
+        }
+        mp3_frame_samples = (uint32_t)lame_get_framesize(lame_guard);
+        is_resampled      = lame_get_out_samplerate(lame_guard) != (int)header.samples_per_second;
+        out->preallocate(estimate_mp3_size(lame_guard, header, pcm_data_position.data_size));
+    } catch (const exception &e) {
+        print_error(message, e.what());
+        remove_mp3_file();
+        return;
+    }
+    uintmax_t priming_samples = (uintmax_t)segment_priming_mp3_frames * mp3_frame_samples;
+    uintmax_t segment_samples = (uintmax_t)Configuration::segment_seconds() * header.samples_per_second
+                                / mp3_frame_samples * mp3_frame_samples;
+    segment_samples           = max(segment_samples, priming_samples);
+    size_t number_of_segments = (size_t)((number_of_samples + segment_samples - 1) / segment_samples);
+    if (is_resampled || number_of_segments < 2) {
+        convert_file_worker(in, out, out_filename, header_extensible, pcm_data_position, message,
+                            list_info_chunk_meta_data, thread_number);
+        return;
+    }
+    uintmax_t segment_memory = memory_needed_for_segment(block_align, header.samples_per_second, in->size());
+    in.reset();  // every segment opens the file on its own
+
+    vector<unique_ptr<Segment> > segments(number_of_segments);
+    size_t                       started = 0;
+    // the segment written next is covered by the memory reserved for the file, see memory_needed_for_file(), the
+    // segments ahead of it are only started while the memory budget allows it. Returns false if it does not
+    auto start_next_segment = [&](const size_t written_next) {
+        size_t k    = started;
+        segments[k] = make_unique<Segment>();
+        if (k > written_next && !segments[k]->memory.try_reserve(segment_memory)) {
+            segments[k].reset();
+            return false;
+        }
+        started++;
+        uintmax_t start   = k * segment_samples;
+        uintmax_t end     = start + segment_samples;
+        bool      is_last = k + 1 == number_of_segments;
+        Segment & segment = *segments[k];
+        segment.first_sample       = start > priming_samples ? start - priming_samples : 0;
+        segment.end_sample         = is_last ? number_of_samples : min(end + priming_samples, number_of_samples);
+        segment.dropped_mp3_frames = (size_t)((start - segment.first_sample) / mp3_frame_samples);
+        segment.kept_mp3_frames    = is_last ? 0 : (size_t)(segment_samples / mp3_frame_samples);
+        using std::placeholders::_1;
+        thread_pool.enqueue(segment.done, bind(encode_segment, in_filename, header_extensible, pcm_data_position,
+                                               message, list_info_chunk_meta_data, k == 0, &segment, _1));
+        return true;
+    };
+
+    // the segments are written in order, after a failure the segments already started are waited for only
+    // As many segments are encoded at the same time as threads are active, which may change with --max-threads
+    bool   has_failed = false;
+    string error;
+    for (size_t k = 0; k < started || (!has_failed && k < number_of_segments); ++k) {
+        while (!has_failed && started < number_of_segments && started < k + thread_pool.active_threads()) {
+            if (!start_next_segment(k)) {
+                break;
+            }
+        }
+        thread_pool.wait(segments[k]->done);
+        const Segment &segment = *segments[k];
+        if (!has_failed) {
+            if (segment.is_aborted || segment.has_failed) {
+                has_failed = true;
+                error      = segment.error;
+            } else {
+                try {
+                    auto [begin, end] = segment_mp3_data_to_join(segment, k == 0);
+                    out->write(segment.mp3_data.data().data() + begin, end - begin);
+                } catch (const exception &e) {
+                    has_failed = true;
+                    error      = e.what();
+                }
+            }
+        }
+        segments[k].reset();  // the encoded MP3 data is not needed anymore
+    }
+    try {
+        if (!has_failed && !out->close()) {
+            throw runtime_error("writing the MP3 file failed");
+        }
+    } catch (const exception &e) {
+        has_failed = true;
+        error      = e.what();
+    }
+    if (has_failed) {
+        // an error of configuring lame has been printed already, aborting by Ctrl-C is not an error
+        if (!error.empty()) {
+            print_error(message, error);
+        }
+        remove_mp3_file();
+        return;
+    }
+    ostringstream ss;
+    ss << OK_PREFIX << message << " converted in " << number_of_segments << " segments" << endl;
+    number_of_converted_files++;
+    tcout << ss.str();
+}
+
 /*!
  * Checks if:
  *    - the passed "filename" exists and is readable
  *    - "filename" is a valid WAV audio file of the supported formats
  *    - opens "filename" as an input stream
  *    - creates the target MP3 file as an output stream
- *    - enqueue a call to convert_file_worker to the thread pool for the actual conversion
+ *    - enqueue a call to convert_file_worker to the pool of the threads encoding for the actual conversion
+ * Is executed in one of the threads doing the I/O, so that many files are probed in parallel.
+ * If "enqueue_conversion" is true the conversion is enqueued to "encoding_pool". Called by a thread of that pool
+ * (no separate I/O threads) the conversion is a subtask, which the same thread executes next unless an idle thread
+ * steals it. Otherwise enqueuing waits while the look-ahead of the encoding pool is full, so the I/O threads do not
+ * probe more files than the threads encoding can take. If "enqueue_conversion" is false the conversion is done
+ * right away (used by Schedule, which measures the time the conversion takes).
+ * If "batcher" is not nullptr the conversions of files with less audio data than Configuration::batch_bytes() are
+ * passed to it instead, so that many of them are enqueued as a single task.
+ * "reservation" is the memory reserved for the file before it was dispatched assuming the worst case, it is corrected
+ * to the memory needed for the file probed and released after the conversion, see MemoryBudget. nullptr if the
+ * caller keeps the reservation
  */
 
-static void convert_file(const fs::path &filename, ThreadPool &thread_pool) {
+static void convert_file(const fs::path filename, ThreadPool &encoding_pool, const bool enqueue_conversion,
+                         TaskBatcher *batcher, shared_ptr<MemoryReservation> reservation, uint16_t thread_number) {
+    // skip the files still queued if the user pressed Ctrl-C (SIGINT) or SIGTERM was sent
+    if (SignalHandler::termination_requested()) {
+        return;
+    }
     ostringstream ss;
     try {
-        std::uintmax_t       file_size = fs::file_size(filename);
-        shared_ptr<ifstream> file(new ifstream());
-
         // open input file
-        file->open(filename, ios::binary);
-        if (file->fail()) {
+        shared_ptr<InputFile> file = InputFile::open(filename, Configuration::input_backend());
+        if (!file) {
             // only print an error if the file name ends with a .wav extension
             if (case_insensitive_compare(filename.extension().string(), ".wav")) {
                 ss.str("");
@@ -745,14 +1240,15 @@ static void convert_file(const fs::path &filename, ThreadPool &thread_pool) {
                    << "\" failed, check permissions." << endl;
                 tcerr << ss.str();
             }
+            return;
         }
 
         // check if a valid RIFF file
         // first read all top level chunks. A valid RIFF file contains at least one "RIFF" chunk
-        auto [top_level_chunks, message] = read_all_chunks(*file, 0, file_size);
+        auto [top_level_chunks, message] = read_all_chunks(*file, 0, file->size());
         ChunkPositionMap riff_chunks;
         tie(riff_chunks, message) =
-            is_chunk_with_format_type_and_subchunks_present(*file, top_level_chunks, "RIFF", "WAVE");
+            is_chunk_with_format_type_and_subchunks_present(*file, top_level_chunks, fourcc("RIFF"), fourcc("WAVE"));
         if (riff_chunks.empty()) {
             // only print an error if the file name ends with a .wav extension
             if (case_insensitive_compare(filename.extension().string(), ".wav")) {
@@ -765,11 +1261,10 @@ static void convert_file(const fs::path &filename, ThreadPool &thread_pool) {
         }
 
         // now aggregate the sub-chunks of all "LIST" chunks with format type "INFO" present in the top level chunks
-        // and in the sub-chunks of the RIFF chunk. The info in the "LIST" chunk contained as "RIFF" sub-chunks takes
-        // precedence
+        // and in the sub-chunks of the RIFF chunk. The info in the top level "LIST" chunk takes precedence
         ChunkPositionMap meta_data;
-        aggregate_meta_data(*file, top_level_chunks, meta_data, "LIST", "INFO");
-        aggregate_meta_data(*file, riff_chunks, meta_data, "LIST", "INFO");
+        aggregate_meta_data(*file, top_level_chunks, meta_data, fourcc("LIST"), fourcc("INFO"));
+        aggregate_meta_data(*file, riff_chunks, meta_data, fourcc("LIST"), fourcc("INFO"));
 
         // check if RIFF file is a valid WAV file with supported content
         FormatHeaderExtensible format_header;
@@ -785,18 +1280,52 @@ static void convert_file(const fs::path &filename, ThreadPool &thread_pool) {
         }
 
         // create an output file (name chosen such that no existing file is overwritten)
-        shared_ptr<ofstream> out_file(new ofstream());
-        fs::path             out_filename;
-        tie(was_successful, message) = open_output_stream(filename, message, *out_file, out_filename);
+        shared_ptr<OutputFile> out_file;
+        fs::path               out_filename;
+        tie(was_successful, message) = open_output_stream(filename, message, out_file, out_filename);
 
         // convert into MP3 file
         if (was_successful) {
             string error;
             using std::placeholders::_1;
-            function<void(const std::uint16_t)> fct = bind(convert_file_worker, file, out_file, out_filename,
-                                                           format_header, pcm_data_position, message, meta_data, _1);
-            // submit actual conversion function to thread pool
-            thread_pool.enqueue(fct);
+            function<void(const std::uint16_t)> fct;
+            // long files are split into segments encoded by several threads, see convert_file_in_segments()
+            const FormatHeader &header           = format_header.header;
+            uint32_t            bytes_per_second = header.bytes_per_second;
+            bool is_segmented = Configuration::segment_seconds() > 0
+                                && (Configuration::number_of_threads() > 1 || Configuration::max_threads() > 1)
+                                && bytes_per_second > 0
+                                && pcm_data_position.data_size / bytes_per_second > Configuration::segment_seconds();
+            if (is_segmented) {
+                fct = bind(convert_file_in_segments, filename, file, out_file, out_filename, format_header,
+                           pcm_data_position, message, meta_data, ref(encoding_pool), _1);
+            } else {
+                fct = bind(convert_file_worker, file, out_file, out_filename, format_header, pcm_data_position,
+                           message, meta_data, _1);
+            }
+            if (reservation) {
+                uint32_t block_align = (header.bits_per_sample + 7) / 8 * header.num_channels;
+                reservation->resize(
+                    memory_needed_for_file(block_align, header.samples_per_second, file->size(), is_segmented));
+                // the memory reserved for the file is released together with the task converting it, after the
+                // buffers bound to the conversion have been released
+                fct = [conversion = move(fct), reservation](const uint16_t thread_number) mutable {
+                    conversion(thread_number);
+                    conversion = nullptr;
+                };
+            }
+            if (batcher && pcm_data_position.data_size < Configuration::batch_bytes()) {
+                batcher->add(fct, pcm_data_position.data_size);
+                // the files collected hold memory reserved, so the batch is passed on if others wait for memory
+                if (MemoryBudget::has_waiters()) {
+                    batcher->flush();
+                }
+            } else if (enqueue_conversion) {
+                // submit actual conversion function to the threads encoding
+                encoding_pool.enqueue(fct);
+            } else {
+                fct(thread_number);
+            }
         } else {
             ss.str("");
             ss << ERROR_PREFIX << message << endl;
@@ -811,14 +1340,151 @@ static void convert_file(const fs::path &filename, ThreadPool &thread_pool) {
     }
 }
 
+/*!
+ * Returns the size of the audio data of "filename" in bytes as estimate of the cost of converting it
+ * or 0 if it is not a valid WAV file. Used for probing the files before they are scheduled, so no errors are printed,
+ * they are printed when the file is converted
+ */
+static uintmax_t estimate_conversion_cost(const fs::path &filename) {
+    try {
+        shared_ptr<InputFile> file = InputFile::open(filename, Configuration::input_backend());
+        if (!file) {
+            return 0;
+        }
+        auto [top_level_chunks, message] = read_all_chunks(*file, 0, file->size());
+        ChunkPositionMap riff_chunks;
+        tie(riff_chunks, message) =
+            is_chunk_with_format_type_and_subchunks_present(*file, top_level_chunks, fourcc("RIFF"), fourcc("WAVE"));
+        if (riff_chunks.empty()) {
+            return 0;
+        }
+        auto [was_successful, format_header, pcm_data_position, error] = is_valid_wav_file(*file, riff_chunks);
+        return was_successful ? pcm_data_position.data_size : 0;
+    } catch (const exception &) {
+        return 0;
+    }
+}
+
+/*!
+ * Returns the sets of CPUs the threads encoding are pinned to in turn, as selected with --cpu-set and
+ * --numa-interleave: the CPUs of every NUMA node (only those of --cpu-set) or every CPU of --cpu-set on its own
+ * Empty if the threads are not pinned
+ */
+static vector<vector<unsigned int> > encoding_thread_placements() {
+    vector<unsigned int>          cpu_set = Configuration::cpu_set();
+    vector<vector<unsigned int> > placements;
+    if (Configuration::numa_interleave()) {
+        for (auto &node : numa_node_cpus()) {
+            vector<unsigned int> cpus;
+            if (cpu_set.empty()) {
+                cpus = node;
+            } else {
+                set_intersection(node.begin(), node.end(), cpu_set.begin(), cpu_set.end(), back_inserter(cpus));
+            }
+            if (!cpus.empty()) {
+                placements.push_back(move(cpus));
+            }
+        }
+    } else {
+        for (unsigned int cpu : cpu_set) {
+            placements.push_back({cpu});
+        }
+    }
+    return placements;
+}
+
+/*!
+ * Pins the calling thread number "thread_number" of a pool to the CPUs placements[thread_number] (modulo their
+ * number), does nothing if "placements" is empty
+ * If pinning fails the threads keep running unpinned, which is reported only once
+ */
+static void pin_thread(const vector<vector<unsigned int> > &placements, const uint16_t thread_number) {
+    static atomic<bool> failure_reported(false);
+    if (placements.empty()) {
+        return;
+    }
+    if (!pin_current_thread(placements[thread_number % placements.size()]) && !failure_reported.exchange(true)) {
+        tcerr << "WARNING: the threads could not be pinned to the CPUs selected, they run on all CPUs\n";
+    }
+}
+
 /*!
  * Iterates over all regular files in the folder referenced by the argument dir_iter and if
  * Configuration::recurse_directories() returns true also all its sub-folders
+ * Returns after all files found have been converted
+ * The directories are read, the files probed and the MP3 files created by the threads doing the I/O, see
+ * DirectoryWalker and convert_file(). They pass the files to the threads encoding. Both pools take new work through
+ * bounded queues, so each stage runs ahead of the next one only as far as the look-ahead allows
  */
-void convert_all_wav_files_in_directory(fs::recursive_directory_iterator &dir_iter) {
+static void convert_all_files_found(fs::recursive_directory_iterator &dir_iter) {
     ostringstream ss;
-    ThreadPool    thread_pool(Configuration::number_of_threads());
-    int           ret_code = 0;
+    // the directory is walked ahead of the threads probing and converting the files as far as the look-ahead
+    // allows, so that the next file is ready as soon as a thread becomes free
+    // with --cpu-set or --numa-interleave the threads encoding are pinned to CPUs, so they do not migrate between
+    // the NUMA nodes and their buffers stay local, see BufferArena. The I/O threads may run on all CPUs selected
+    vector<vector<unsigned int> > encoding_placements = encoding_thread_placements();
+    vector<vector<unsigned int> > io_placements;
+    if (!Configuration::cpu_set().empty()) {
+        io_placements.push_back(Configuration::cpu_set());
+    }
+    // with --max-threads the pool has threads up to that number, of which the controller activates as many as keep
+    // the CPUs busy while threads wait for I/O
+    unique_ptr<ConcurrencyController> controller;
+    if (Configuration::max_threads() > 0) {
+        unsigned int cpus = available_cpus();
+        if (!Configuration::cpu_set().empty()) {
+            cpus = min(cpus, (unsigned int)Configuration::cpu_set().size());
+        }
+        controller.reset(new ConcurrencyController(Configuration::min_threads(), Configuration::max_threads(), cpus,
+                                                   chrono::milliseconds(Configuration::adapt_interval())));
+    }
+    uint16_t   encoding_threads = controller ? Configuration::max_threads() : Configuration::number_of_threads();
+    ThreadPool encoding_pool(encoding_threads, Configuration::look_ahead(), "encoder",
+                             [&encoding_placements, &controller](const uint16_t thread_number) {
+                                 pin_thread(encoding_placements, thread_number);
+                                 if (controller) {
+                                     controller->attach_current_thread(thread_number);
+                                 }
+                             });
+    if (controller) {
+        controller->control(encoding_pool, Configuration::number_of_threads());
+    }
+    // every thread encoding keeps its buffers and its encoder for the whole run, the files dispatched share the
+    // remaining memory budget, see MemoryBudget
+    uintmax_t thread_memory = encoding_threads * memory_needed_per_thread();
+    uintmax_t file_memory   = memory_needed_for_file(max_bytes_per_frame, min_samples_per_second, UINTMAX_MAX,
+                                                   Configuration::segment_seconds() > 0);
+    uintmax_t probe_memory  = InputFile::memory_needed(Configuration::input_backend(), 0) + task_memory;
+    MemoryBudget::set_aside(thread_memory);
+    if (MemoryBudget::limit() > 0 && MemoryBudget::limit() < thread_memory + file_memory) {
+        ss.str("");
+        ss << "WARNING: the memory limit is less than the " << (thread_memory + file_memory) / (1024 * 1024) + 1
+           << " MB the threads and a single file may need, so the files are converted one after the other" << endl;
+        tcerr << ss.str();
+    }
+    // the I/O threads are mostly waiting for the file system, so there can be more threads than cores in total
+    // without --io-threads the threads encoding do the I/O as well
+    // The I/O pool is destroyed first, so the files still being probed are passed to the encoding pool
+    unique_ptr<ThreadPool> separate_io_pool;
+    if (Configuration::io_threads() > 0) {
+        separate_io_pool.reset(new ThreadPool(Configuration::io_threads(), Configuration::look_ahead(), "io",
+                                              [&io_placements](const uint16_t thread_number) {
+                                                  pin_thread(io_placements, thread_number);
+                                              }));
+    }
+    ThreadPool &    io_pool = separate_io_pool ? *separate_io_pool : encoding_pool;
+    DirectoryWalker walker(io_pool, Configuration::recurse_directories(), Configuration::scan_fan_out(),
+                           !Configuration::unordered_walk());
+    // small files are converted in batches, after the walk the files probed so far are waited for
+    // and the last batch is enqueued
+    TaskBatcher batcher(encoding_pool, Configuration::batch_bytes());
+    TaskBatcher *batcher_used = Configuration::batch_bytes() > 0 ? &batcher : nullptr;
+    TaskGroup    probing;
+    // unless the files are converted while walking the directories, all files are probed first for estimating the
+    // cost of converting them and then converted in the order given by the schedule policy
+    bool      is_scheduled = Configuration::schedule_policy() != SchedulePolicy::stream;
+    Schedule  schedule(Configuration::schedule_policy());
+    TaskGroup probes;
     try {
         auto entry_dir_name = dir_iter->path().parent_path().string();
         ss.str("");
@@ -827,43 +1493,105 @@ void convert_all_wav_files_in_directory(fs::recursive_directory_iterator &dir_it
         if (Configuration::recurse_directories()) {
             ss << "and all its subdirectories ";
         }
-        ss << "using " << Configuration::number_of_threads() << " threads." << endl;
+        ss << "using " << Configuration::number_of_threads() << " threads";
+        if (controller) {
+            ss << " (adapted between " << Configuration::min_threads() << " and " << Configuration::max_threads()
+               << ")";
+        }
+        if (separate_io_pool) {
+            ss << " and " << Configuration::io_threads() << " I/O threads";
+        }
+        ss << "." << endl;
         tcout << ss.str();
-        string current_dir_name;
-        for (const fs::directory_entry &entry : dir_iter) {
-            // if the user sends SITERM or presses Ctrl-C (sending SIGINT),
-            // abort processing
-            if (SignalHandler::termination_requested()) {
-                break;
-            }
-            if (fs::is_directory(entry)) {
-                // if the --recursive flag is NOT set
-                // disable the recursion so that only the files in the top level
-                // directory are processed
-                if (!Configuration::recurse_directories()) {
-                    dir_iter.disable_recursion_pending();
-                }
-                continue;
-            }
+        // if the user sends SITERM or presses Ctrl-C (sending SIGINT), the walk is aborted
+        walker.walk(dir_iter->path().parent_path(), [&](const fs::path &path) {
             // convert the file if it ends with .wav or if the command line options
             // -a/--all (convert_all_files()==true) has been passed
-            if (!(Configuration::convert_all_files()
-                  || case_insensitive_compare(entry.path().extension().string(), ".wav"))) {
-                continue;
+            if (!(Configuration::convert_all_files() || case_insensitive_compare(path.extension().string(), ".wav"))) {
+                return;
             }
             try {
-                convert_file(entry.path(), thread_pool);
+                using std::placeholders::_1;
+                // dispatching waits while the memory budget is used up, the files collected for a batch are passed
+                // on then, since they hold memory reserved themselves
+                auto reservation = make_shared<MemoryReservation>();
+                if (is_scheduled) {
+                    reservation->reserve(probe_memory);
+                    size_t index = schedule.add(path);
+                    io_pool.enqueue(probes, [&schedule, index, path, reservation](const uint16_t) {
+                        schedule.set_cost(index, estimate_conversion_cost(path));
+                    });
+                } else {
+                    reservation->reserve(file_memory, [batcher_used]() {
+                        if (batcher_used) {
+                            batcher_used->flush();
+                        }
+                    });
+                    io_pool.enqueue(probing, bind(convert_file, path, ref(encoding_pool), true, batcher_used,
+                                                  reservation, _1));
+                }
             } catch (const exception &e) {
-                ss.str("");
-                ss << ERROR_PREFIX << "processing file " << entry.path().filename() << " failed: " << e.what() << endl;
+                ostringstream ss;
+                ss << ERROR_PREFIX << "processing file " << path.filename() << " failed: " << e.what() << endl;
                 tcerr << ss.str();
                 set_return_code(RET_CODE_CONVERTING_SOME_FILES_FAILED);
             }
-        }
+        });
     } catch (const exception &e) {
         ss.str("");
         ss << ERROR_PREFIX << "iterating over files failed: " << e.what() << endl;
         tcerr << ss.str();
         set_return_code(RET_CODE_DIR_ITER_FAILED);
     }
+    io_pool.wait(probing);
+    batcher.flush();
+    if (is_scheduled) {
+        // like the files enqueued while walking, the files found before an error are converted
+        io_pool.wait(probes);
+        // the time a conversion takes is measured in the thread encoding, so the files are probed once more there
+        schedule.run(
+            encoding_pool,
+            [&encoding_pool](const fs::path &path, const uint16_t thread_number) {
+                convert_file(path, encoding_pool, false, nullptr, nullptr, thread_number);
+            },
+            [file_memory](const fs::path &) -> shared_ptr<void> {
+                auto reservation = make_shared<MemoryReservation>();
+                reservation->reserve(file_memory);
+                return reservation;
+            });
+        if (!SignalHandler::termination_requested()) {
+            tostream::flush();  // the queue to the output is empty then, so the report is not dropped
+            tcout << schedule.report(Configuration::number_of_threads());
+        }
+    }
+}
+
+void convert_all_wav_files_in_directory(fs::recursive_directory_iterator &dir_iter) {
+    auto start = chrono::steady_clock::now();
+    convert_all_files_found(dir_iter);
+    if (SignalHandler::termination_requested()) {
+        return;
+    }
+    ostringstream ss;
+    ss << fixed;
+    // the throughput tells how much the per file overhead costs with the batches of --batch-bytes
+    if (Configuration::batch_bytes() > 0) {
+        chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+        size_t                   files   = number_of_converted_files;
+        ss << setprecision(2) << files << " files converted in " << seconds.count() << " s ("
+           << (seconds.count() > 0.0 ? (double)files / seconds.count() : 0.0) << " files/s)" << endl;
+    }
+    // the peak of the memory reserved tells whether the limit passed with --memory-limit held, the peak of the
+    // memory allocated how close the estimates reserved are
+    if (MemoryBudget::limit() > 0) {
+        const double megabyte = 1024.0 * 1024.0;
+        ss << setprecision(1) << "peak memory of the files in flight: " << MemoryBudget::peak_allocated() / megabyte
+           << " MB allocated, " << MemoryBudget::peak_reserved() / megabyte << " MB reserved of the limit of "
+           << MemoryBudget::limit() / megabyte << " MB" << endl;
+    }
+    if (ss.str().empty()) {
+        return;
+    }
+    tostream::flush();  // waits for the status lines of the files, so the summary finds room in the queue
+    tcout << ss.str();
 }
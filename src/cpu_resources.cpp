@@ -0,0 +1,255 @@
+#include "cpu_resources.h"
+
+#include "thread_includes.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#endif
+
+using namespace std;
+
+// the highest CPU number accepted, the Linux kernel supports at most 8192 CPUs
+static const unsigned long max_cpu_number = 8191;
+
+static thread_local bool current_thread_pinned = false;  // see is_current_thread_pinned()
+
+#ifdef __linux__
+
+namespace fs = std::filesystem;
+
+// returns the CPU quota of the cgroup v2 directory "directory" in CPUs, 0 if it has none
+// cpu.max contains the quota and the period in microseconds or "max" for no quota
+static double cgroup_v2_quota(const fs::path &directory) {
+    ifstream file(directory / "cpu.max");
+    string   quota;
+    double   period = 0;
+    if (!(file >> quota >> period) || quota == "max" || period <= 0) {
+        return 0;
+    }
+    return atof(quota.c_str()) / period;
+}
+
+// returns the CPU quota of the cgroup v1 directory "directory" in CPUs, 0 if it has none
+// cpu.cfs_quota_us is -1 if there is no quota
+static double cgroup_v1_quota(const fs::path &directory) {
+    ifstream quota_file(directory / "cpu.cfs_quota_us");
+    ifstream period_file(directory / "cpu.cfs_period_us");
+    double   quota  = 0;
+    double   period = 0;
+    if (!(quota_file >> quota) || !(period_file >> period) || quota <= 0 || period <= 0) {
+        return 0;
+    }
+    return quota / period;
+}
+
+// returns the smallest CPU quota of the cgroup "cgroup_path" of the hierarchy mounted at "mount" and of its
+// parents, since the quota of a parent limits all cgroups below it. 0 if none of them has a quota
+// Inside a container the cgroup of the process is often mounted as the root of the hierarchy while its path
+// is still the one on the host, so directories not existing are skipped on the way up
+static double smallest_quota(const fs::path &mount, const string &cgroup_path,
+                             double (*quota_of)(const fs::path &)) {
+    double   smallest = 0;
+    fs::path path     = fs::path(cgroup_path).relative_path();
+    while (true) {
+        double quota = quota_of(mount / path);
+        if (quota > 0 && (smallest == 0 || quota < smallest)) {
+            smallest = quota;
+        }
+        if (path.empty()) {
+            return smallest;
+        }
+        path = path.parent_path();
+    }
+}
+
+// returns the CPU quota of the process in CPUs, 0 if there is none
+// Every line of /proc/self/cgroup has the form "hierarchy-ID:controller-list:cgroup-path", the line of
+// cgroup v2 starts with "0::". The hierarchies are expected at the usual mount points below /sys/fs/cgroup
+static double cgroup_quota() {
+    ifstream cgroups("/proc/self/cgroup");
+    string   line;
+    double   smallest = 0;
+    while (getline(cgroups, line)) {
+        auto first  = line.find(':');
+        auto second = first == string::npos ? string::npos : line.find(':', first + 1);
+        if (second == string::npos) {
+            continue;
+        }
+        string controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+        string path        = line.substr(second + 1);
+        double quota       = 0;
+        if (line.compare(0, first, "0") == 0 && controllers == ",,") {
+            quota = smallest_quota("/sys/fs/cgroup", path, cgroup_v2_quota);
+        } else if (controllers.find(",cpu,") != string::npos) {
+            quota = smallest_quota("/sys/fs/cgroup/cpu,cpuacct", path, cgroup_v1_quota);
+            if (quota == 0) {
+                quota = smallest_quota("/sys/fs/cgroup/cpu", path, cgroup_v1_quota);
+            }
+        }
+        if (quota > 0 && (smallest == 0 || quota < smallest)) {
+            smallest = quota;
+        }
+    }
+    return smallest;
+}
+
+#endif  // __linux__
+
+unsigned int available_cpus() {
+    static const unsigned int cpus = [] {
+        unsigned int cpus = pthread::thread::hardware_concurrency();
+#ifdef __linux__
+        unsigned int cpus_in_mask = (unsigned int)affinity_mask_cpus().size();
+        if (cpus_in_mask > 0) {
+            cpus = cpus_in_mask;
+        }
+        // a quota of 1.5 CPUs keeps two threads busy three quarters of the time, so it is rounded up
+        double quota = cgroup_quota();
+        if (quota > 0) {
+            cpus = cpus == 0 ? (unsigned int)ceil(quota) : min(cpus, (unsigned int)ceil(quota));
+        }
+#endif
+        return max(cpus, 1u);
+    }();
+    return cpus;
+}
+
+vector<unsigned int> affinity_mask_cpus() {
+    vector<unsigned int> cpus;
+#ifdef __linux__
+    // the mask passed must be large enough for all CPUs of the host, so it is enlarged until it is
+    for (int number_of_cpus = CPU_SETSIZE; number_of_cpus <= (int)max_cpu_number + 1; number_of_cpus *= 2) {
+        cpu_set_t *set = CPU_ALLOC(number_of_cpus);
+        if (set == nullptr) {
+            break;
+        }
+        size_t size = CPU_ALLOC_SIZE(number_of_cpus);
+        CPU_ZERO_S(size, set);
+        int res   = sched_getaffinity(0, size, set);
+        int error = errno;
+        for (int cpu = 0; res == 0 && cpu < number_of_cpus; ++cpu) {
+            if (CPU_ISSET_S(cpu, size, set)) {
+                cpus.push_back((unsigned int)cpu);
+            }
+        }
+        CPU_FREE(set);
+        if (res == 0 || error != EINVAL) {
+            break;
+        }
+    }
+#endif
+    return cpus;
+}
+
+vector<vector<unsigned int> > numa_node_cpus() {
+    vector<pair<unsigned long, vector<unsigned int> > > nodes;
+#ifdef __linux__
+    // every node has a directory "node<number>" listing its CPUs in the file "cpulist"
+    error_code ec;
+    for (auto &entry : fs::directory_iterator("/sys/devices/system/node", ec)) {
+        string name = entry.path().filename().string();
+        if (name.compare(0, 4, "node") != 0 || name.size() == 4
+            || name.find_first_not_of("0123456789", 4) != string::npos) {
+            continue;
+        }
+        ifstream             file(entry.path() / "cpulist");
+        string               list;
+        vector<unsigned int> cpus;
+        if (getline(file, list) && parse_cpu_list(list, cpus)) {
+            nodes.emplace_back(strtoul(name.c_str() + 4, nullptr, 10), move(cpus));
+        }
+    }
+    sort(nodes.begin(), nodes.end());
+#endif
+    vector<vector<unsigned int> > node_cpus;
+    for (auto &node : nodes) {
+        node_cpus.push_back(move(node.second));
+    }
+    return node_cpus;
+}
+
+bool parse_cpu_list(const string &list, vector<unsigned int> &cpus) {
+    cpus.clear();
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        end        = end == string::npos ? list.size() : end;
+        // every element is a single CPU or a range of CPUs "first-last"
+        string        element = list.substr(start, end - start);
+        const char *  digits  = element.c_str();
+        char *        rest    = nullptr;
+        unsigned long first   = strtoul(digits, &rest, 10);
+        unsigned long last    = first;
+        if (!isdigit((unsigned char)*digits)) {
+            return false;
+        }
+        if (*rest == '-') {
+            digits = rest + 1;
+            if (!isdigit((unsigned char)*digits)) {
+                return false;
+            }
+            last = strtoul(digits, &rest, 10);
+        }
+        if (*rest != '\0' || last < first || last > max_cpu_number) {
+            return false;
+        }
+        for (unsigned long cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back((unsigned int)cpu);
+        }
+        start = end + 1;
+    }
+    sort(cpus.begin(), cpus.end());
+    cpus.erase(unique(cpus.begin(), cpus.end()), cpus.end());
+    return !cpus.empty();
+}
+
+bool pin_current_thread(const vector<unsigned int> &cpus) {
+#ifdef __linux__
+    if (cpus.empty()) {
+        return false;
+    }
+    int        number_of_cpus = (int)*max_element(cpus.begin(), cpus.end()) + 1;
+    cpu_set_t *set            = CPU_ALLOC(number_of_cpus);
+    if (set == nullptr) {
+        return false;
+    }
+    size_t size = CPU_ALLOC_SIZE(number_of_cpus);
+    CPU_ZERO_S(size, set);
+    for (unsigned int cpu : cpus) {
+        CPU_SET_S(cpu, size, set);
+    }
+    // pid 0 is the calling thread, not the whole process
+    int res = sched_setaffinity(0, size, set);
+    CPU_FREE(set);
+    current_thread_pinned = current_thread_pinned || res == 0;
+    return res == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+bool is_current_thread_pinned() {
+    return current_thread_pinned;
+}
+
+void name_current_thread(const string &name) {
+#ifdef __linux__
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#else
+    (void)name;
+#endif
+}
@@ -0,0 +1,45 @@
+//
+// declares functions querying the CPUs the process can use and placing threads on them
+// available_cpus() returns the number of CPUs the process can actually use. hardware_concurrency() returns the
+// number of CPUs of the host. In a container limited to a few CPUs by a cgroup CPU quota, or started with an
+// affinity mask (taskset, cpuset), that is far more than the process gets: the additional threads only fight over
+// the quota and are throttled by the scheduler.
+// So under Linux the number is reduced to the CPUs in the affinity mask and to the cgroup v1 or v2 CPU quota
+// rounded up to whole CPUs. On other platforms it is the number of CPUs of the host
+// Threads pinned to the CPUs of one NUMA node keep their memory accesses local to that node instead of migrating
+// between the sockets of the host. Pinning and naming threads is only supported under Linux, on other platforms
+// the functions do nothing
+//
+
+#ifndef CPU_RESOURCES_H
+#define CPU_RESOURCES_H
+
+#include <string>
+#include <vector>
+
+// returns the number of CPUs available to the process, at least 1
+// the value is determined only once per process
+unsigned int available_cpus();
+
+// returns the CPUs in the affinity mask of the calling thread in ascending order, empty if unknown
+std::vector<unsigned int> affinity_mask_cpus();
+
+// returns the CPUs of every NUMA node of the host ordered by node, nodes without CPUs are left out
+// empty if the NUMA topology is unknown
+std::vector<std::vector<unsigned int> > numa_node_cpus();
+
+// parses a list of CPUs like "0-3,8,10-11", as used by taskset and by the Linux sysfs, into "cpus" in ascending
+// order. Returns false if the list is malformed or empty
+bool parse_cpu_list(const std::string &list, std::vector<unsigned int> &cpus);
+
+// pins the calling thread to the CPUs "cpus", returns false if that failed or is not supported
+bool pin_current_thread(const std::vector<unsigned int> &cpus);
+
+// returns true if the calling thread has been pinned by pin_current_thread()
+bool is_current_thread_pinned();
+
+// names the calling thread, so tools like top and perf show which thread is which
+// the name is cut to the 15 characters allowed by Linux
+void name_current_thread(const std::string &name);
+
+#endif  // CPU_RESOURCES_H
@@ -0,0 +1,168 @@
+#include "directory_walker.h"
+#include "signal_handler.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+DirectoryWalker::DirectoryWalker(ThreadPool &thread_pool, const bool recursive, const size_t fan_out,
+                                 const bool ordered)
+    : _thread_pool(thread_pool)
+    , _recursive(recursive)
+    , _fan_out(fan_out > 0 ? fan_out : 1)
+    , _ordered(ordered)
+    , _free(0)
+    , _stop(false) {
+}
+
+void DirectoryWalker::walk(const fs::path &root, function<void(const fs::path &)> visit) {
+    _stop = false;
+    _free = _fan_out - 1;  // the top level directory takes the first place
+    auto listing  = make_shared<Listing>();
+    listing->path = root;
+    queue(listing);
+    try {
+        if (_ordered) {
+            visit_ordered(*listing, visit);
+        } else {
+            visit_unordered(visit);
+        }
+    } catch (...) {
+        // the tasks still reading refer to this instance, so let them stop and wait for them
+        _stop = true;
+        _thread_pool.wait(_tasks);
+        _read.clear();
+        throw;
+    }
+    _stop = true;  // nothing left to read unless the walk has been aborted by Ctrl-C
+    _thread_pool.wait(_tasks);
+    _read.clear();
+}
+
+void DirectoryWalker::read(shared_ptr<Listing> listing) {
+    vector<shared_ptr<Listing> > queued;
+    try {
+        read_entries(listing->path, *listing, queued);
+    } catch (...) {
+        listing->error = current_exception();
+    }
+    // the places of the subdirectories in the fan-out have been reserved already, so they are queued even if
+    // reading failed. A worker executes the task queued last first, so they are queued in reverse order to be read
+    // in the order they are visited
+    for (auto it = queued.rbegin(); it != queued.rend(); ++it) {
+        queue(*it);
+    }
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    listing->done = true;
+    if (!_ordered) {
+        _read.push_back(listing);
+    }
+    _was_read.notify_all();
+}
+
+void DirectoryWalker::read_entries(const fs::path &directory, Listing &listing,
+                                   vector<shared_ptr<Listing> > &queued) {
+    for (const fs::directory_entry &entry : fs::directory_iterator(directory)) {
+        if (should_stop()) {
+            return;
+        }
+        // the type of the entry is mostly known from reading the directory already, so usually no further
+        // system call is needed
+        if (!entry.is_directory()) {
+            listing.entries.push_back({entry.path(), nullptr});
+            continue;
+        }
+        // like recursive_directory_iterator symbolic links to directories are not followed
+        if (!_recursive || entry.is_symlink()) {
+            continue;
+        }
+        if (try_reserve()) {
+            auto subdirectory  = make_shared<Listing>();
+            subdirectory->path = entry.path();
+            listing.entries.push_back({fs::path(), subdirectory});
+            queued.push_back(subdirectory);
+        } else {
+            // the fan-out is reached, so read the subdirectory right away
+            read_entries(entry.path(), listing, queued);
+        }
+    }
+}
+
+bool DirectoryWalker::try_reserve() {
+    size_t free = _free;
+    while (free > 0) {
+        if (_free.compare_exchange_weak(free, free - 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void DirectoryWalker::queue(shared_ptr<Listing> listing) {
+    _thread_pool.enqueue(_tasks, [this, listing](const uint16_t) { read(listing); });
+}
+
+void DirectoryWalker::wait_until_read(Listing &listing) {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    while (!listing.done) {
+        _was_read.wait(lock);
+    }
+}
+
+void DirectoryWalker::visit_ordered(Listing &listing, const function<void(const fs::path &)> &visit) {
+    wait_until_read(listing);
+    _free++;  // its subdirectories have been queued already, so its place is free again
+    for (auto &entry : listing.entries) {
+        if (should_stop()) {
+            return;
+        }
+        if (entry.subdirectory) {
+            visit_ordered(*entry.subdirectory, visit);
+            entry.subdirectory.reset();  // the subdirectory is not needed anymore
+        } else {
+            visit(entry.file);
+        }
+    }
+    if (listing.error) {
+        rethrow_exception(listing.error);
+    }
+}
+
+void DirectoryWalker::visit_unordered(const function<void(const fs::path &)> &visit) {
+    while (true) {
+        shared_ptr<Listing> listing;
+        {
+            pthread::unique_lock<pthread::mutex> lock(_mutex);
+            while (_read.empty()) {
+                _was_read.wait(lock);
+            }
+            listing = move(_read.front());
+            _read.pop_front();
+        }
+        _free++;
+        for (const auto &entry : listing->entries) {
+            if (should_stop()) {
+                return;
+            }
+            // the subdirectories are visited when they have been read
+            if (!entry.subdirectory) {
+                visit(entry.file);
+            }
+        }
+        if (listing->error) {
+            rethrow_exception(listing->error);
+        }
+        // the subdirectories of a directory take their places before it is passed to _read,
+        // so if all places are free no directory is left to read
+        if (_free == _fan_out) {
+            return;
+        }
+    }
+}
+
+bool DirectoryWalker::should_stop() const {
+    return _stop || SignalHandler::termination_requested();
+}
@@ -0,0 +1,97 @@
+//
+// declares class DirectoryWalker walking a directory tree with the threads of a ThreadPool
+// Every directory is read by a task of the pool, which queues the subdirectories it finds as further tasks, so on
+// slow file systems (e.g. NFS) many directories are read at the same time. The files found are passed to a callback
+// in the thread calling walk(), either in the order a serial walk would find them or in the order the directories
+// have been read.
+// The fan-out limits the number of directories queued, being read or read but not processed yet. If no more
+// directories may be queued, a task reads the subdirectory itself right away, so the memory needed for the file
+// names found ahead stays bounded however large the tree is.
+//
+
+#ifndef DIRECTORY_WALKER_H
+#define DIRECTORY_WALKER_H
+
+#include "thread_pool.h"
+
+#include "thread_includes.h"
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class DirectoryWalker {
+  public:
+    // "recursive": walk through all subdirectories, otherwise only the files in the top level directory are found
+    // "fan_out": number of directories which may be queued or read ahead, at least 1
+    // "ordered": pass the files in the order of a serial walk, otherwise as soon as their directory has been read
+    DirectoryWalker(ThreadPool &thread_pool, const bool recursive, const std::size_t fan_out, const bool ordered);
+
+    DirectoryWalker(const DirectoryWalker &) = delete;
+    DirectoryWalker &operator=(const DirectoryWalker &) = delete;
+
+    // calls "visit" in the calling thread for every entry in "root" (and its subdirectories) which is not a directory
+    // Like std::filesystem::recursive_directory_iterator symbolic links to directories are not followed.
+    // Stops if SignalHandler::termination_requested() returns true.
+    // throws std::filesystem::filesystem_error if a directory could not be read, after all files found before
+    // have been passed to "visit"
+    void walk(const std::filesystem::path &root, std::function<void(const std::filesystem::path &)> visit);
+
+  private:
+    struct Listing;
+
+    // a file found or a subdirectory read by a task of its own
+    typedef struct Entry {
+        std::filesystem::path    file;
+        std::shared_ptr<Listing> subdirectory;  // nullptr if the entry is a file
+    } Entry;
+
+    // the entries found by the task reading a directory
+    // including the entries of all subdirectories the task has read itself
+    typedef struct Listing {
+        std::filesystem::path path;
+        std::vector<Entry>    entries;
+        std::exception_ptr    error;         // set if reading the directory or one of its subdirectories failed
+        bool                  done = false;  // protected by _mutex
+    } Listing;
+
+  private:
+    // reads the directory of "listing" in a task of the pool
+    void read(std::shared_ptr<Listing> listing);
+    // adds the entries of "directory" to "listing", queues the subdirectories to "queued" if the fan-out allows
+    void read_entries(const std::filesystem::path &directory, Listing &listing,
+                      std::vector<std::shared_ptr<Listing> > &queued);
+    // takes a free place of the fan-out, returns false if there is none
+    bool try_reserve();
+    // queues the task reading "listing", a free place must have been reserved
+    void queue(std::shared_ptr<Listing> listing);
+    // waits until "listing" has been read
+    void wait_until_read(Listing &listing);
+    // pass the entries of "listing" to "visit" in the order of a serial walk
+    void visit_ordered(Listing &listing, const std::function<void(const std::filesystem::path &)> &visit);
+    // pass the entries of the directories in the order they have been read
+    void visit_unordered(const std::function<void(const std::filesystem::path &)> &visit);
+    // returns true if the walk should end early
+    bool should_stop() const;
+
+  private:
+    ThreadPool &      _thread_pool;
+    const bool        _recursive;
+    const std::size_t _fan_out;
+    const bool        _ordered;
+
+    std::atomic<std::size_t> _free;   // number of directories which can be queued before the fan-out is reached
+    std::atomic<bool>        _stop;   // set if the walk ends early, so the tasks still reading can stop too
+    TaskGroup                _tasks;  // all tasks reading directories, waited for before walk() returns
+
+    pthread::mutex                        _mutex;     // protects Listing::done and _read
+    pthread::condition_variable           _was_read;  // signals that a directory has been read
+    std::deque<std::shared_ptr<Listing> > _read;      // the listings read but not visited yet if not _ordered
+};
+
+#endif  // DIRECTORY_WALKER_H
@@ -0,0 +1,572 @@
+#include "input_file.h"
+#include "cpu_resources.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// size of the buffer of an std::ifstream, BUFSIZ of the common standard libraries
+static const size_t stream_buffer_size = 8192;
+
+InputFile::InputFile()
+    : _size(0)
+    , _head_window_read(false) {
+}
+
+InputFile::~InputFile() {
+}
+
+shared_ptr<InputFile> InputFile::open(const fs::path &filename, const InputBackend backend) {
+    switch (backend) {
+        case InputBackend::mmap: {
+            shared_ptr<MappedInputFile> file(new MappedInputFile());
+            return file->open(filename) ? file : nullptr;
+        }
+        case InputBackend::io_uring: {
+            shared_ptr<UringInputFile> file(new UringInputFile());
+            if (file->open(filename)) {
+                return file;
+            }
+            // if setting up io_uring failed, e.g. due to resource limits, fall back to ifstream
+        }
+            [[fallthrough]];
+        case InputBackend::ifstream:
+        default: {
+            shared_ptr<StreamInputFile> file(new StreamInputFile());
+            return file->open(filename) ? file : nullptr;
+        }
+    }
+}
+
+uintmax_t InputFile::memory_needed(const InputBackend backend, const size_t block_size, const uintmax_t file_size) {
+    uintmax_t head_window = min((uintmax_t)head_window_size, file_size);
+    uintmax_t block       = min((uintmax_t)block_size, file_size);
+    if (backend == InputBackend::mmap) {
+        // nothing is allocated, but the pages of the mapping are resident until they are released, see
+        // release_before(). These are about the block being converted and the one read ahead by the kernel
+        return head_window + 2 * block;
+    }
+    // the ring of blocks read ahead, the buffer for synchronous reads and the buffers of the streams. io_uring may
+    // fall back to ifstream, so both are estimated alike
+    uintmax_t read_ahead = min((uintmax_t)Configuration::read_ahead() * block_size, file_size);
+    return head_window + block + read_ahead + 2 * stream_buffer_size;
+}
+
+uintmax_t InputFile::size() const {
+    return _size;
+}
+
+const byte *InputFile::view_head_window(const uintmax_t start, const size_t size) {
+    // the first call reads the head window
+    if (!_head_window_read) {
+        _head_window_read = true;
+        _head_window.resize(_size < head_window_size ? (size_t)_size : head_window_size);
+        _head_window_charge.set(_head_window.capacity());
+        if (!read(_head_window.data(), 0, _head_window.size())) {
+            _head_window.clear();
+        }
+    }
+    if (start + size <= _head_window.size()) {
+        return _head_window.data() + start;
+    }
+    return nullptr;
+}
+
+bool InputFile::read(byte * /* buffer */, const uintmax_t /* start */, const size_t /* size */) {
+    return false;
+}
+
+void InputFile::advise_sequential(const uintmax_t /* start */, const uintmax_t /* size */) {
+}
+
+void InputFile::release_before(const uintmax_t /* position */) {
+}
+
+void InputFile::touch(const uintmax_t /* start */, const size_t /* size */) {
+}
+
+StreamInputFile::StreamInputFile()
+    : _buffer_start(0)
+    , _blocks(Configuration::read_ahead())
+    , _read_ahead_start(0)
+    , _read_ahead_end(0)
+    , _block_size(0)
+    , _blocks_read(0)
+    , _blocks_released(0)
+    , _stop(false) {
+}
+
+StreamInputFile::~StreamInputFile() {
+    stop_read_ahead();
+}
+
+bool StreamInputFile::open(const fs::path &filename) {
+    _filename = filename;
+    _stream.open(filename, ios::binary);
+    if (_stream.fail()) {
+        return false;
+    }
+    _stream.seekg(0, ios_base::end);
+    _size = (uintmax_t)_stream.tellg();
+    _buffer_start = 0;
+    return !_stream.fail();
+}
+
+void StreamInputFile::advise_sequential(const uintmax_t start, const uintmax_t size) {
+    // the blocks read ahead for a previously advised range are not needed anymore
+    stop_read_ahead();
+    if (start >= _size) {
+        return;
+    }
+    _read_ahead_start = start;
+    _read_ahead_end   = size > _size - start ? _size : start + size;
+    _block_size       = 0;
+}
+
+const byte *StreamInputFile::view(const uintmax_t start, const size_t size) {
+    if (start > _size || size > _size - start) {
+        return nullptr;
+    }
+    // the first view into the advised range defines the block size and starts reading ahead
+    if (!_read_ahead_thread && _block_size == 0 && !_blocks.empty() && start == _read_ahead_start
+        && start < _read_ahead_end && size > 0) {
+        _block_size          = size;
+        uintmax_t range_size = _read_ahead_end - _read_ahead_start;
+        if (_read_ahead_end <= _head_window.size()) {
+            // the whole range is served from the head window
+        } else if (range_size <= (uintmax_t)_blocks.size() * _block_size) {
+            // the whole range fits into the blocks read ahead, so reading it at once costs less than starting
+            // a helper thread opening the file once more
+            fill_buffer(_read_ahead_start, (size_t)range_size);
+        } else {
+            _blocks_read     = 0;
+            _blocks_released = 0;
+            _stop            = false;
+            _read_ahead_thread.reset(new pthread::thread(
+                reinterpret_cast<void *(*)(void *)>(&StreamInputFile::read_ahead_function), this));
+        }
+    }
+    if (_read_ahead_thread) {
+        if (const byte *block = view_read_ahead(start, size)) {
+            return block;
+        }
+    }
+    if (const byte *head = view_head_window(start, size)) {
+        return head;
+    }
+    // serve the request from the buffer if it contains the requested bytes already
+    if (start >= _buffer_start && start + size <= _buffer_start + _buffer.size()) {
+        return _buffer.data() + (start - _buffer_start);
+    }
+    return fill_buffer(start, size);
+}
+
+const byte *StreamInputFile::fill_buffer(const uintmax_t start, const size_t size) {
+    _buffer.resize(size);
+    _buffer_charge.set(_buffer.capacity());
+    _buffer_start = start;
+    if (!read(_buffer.data(), start, size)) {
+        _buffer.clear();
+        return nullptr;
+    }
+    return _buffer.data();
+}
+
+bool StreamInputFile::read(byte *buffer, const uintmax_t start, const size_t size) {
+    _stream.clear();
+    _stream.seekg(start);
+    _stream.read((char *)buffer, size);
+    return (size_t)_stream.gcount() == size;
+}
+
+const byte *StreamInputFile::view_read_ahead(const uintmax_t start, const size_t size) {
+    if (start < _read_ahead_start || start >= _read_ahead_end || size > _read_ahead_end - start) {
+        return nullptr;
+    }
+    uintmax_t number      = (start - _read_ahead_start) / _block_size;
+    uintmax_t block_start = _read_ahead_start + number * _block_size;
+    if (start + size > block_start + _block_size) {
+        return nullptr;  // the requested bytes span two blocks
+    }
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    if (number < _blocks_released) {
+        return nullptr;  // the block has been released already
+    }
+    // the blocks before are not going to be viewed anymore, so their buffers can be filled with the next blocks
+    if (number > _blocks_released) {
+        _blocks_released = number;
+        _block_released.notify_one();
+    }
+    while (_blocks_read <= number) {
+        _block_read.wait(lock);
+    }
+    const ReadAheadBlock &block = _blocks[number % _blocks.size()];
+    if (block.has_failed) {
+        return nullptr;  // try it once more synchronously to get a meaningful result
+    }
+    return block.buffer.data() + (start - block_start);
+}
+
+void StreamInputFile::stop_read_ahead() {
+    if (!_read_ahead_thread) {
+        return;
+    }
+    {
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        _stop = true;
+        _block_released.notify_one();
+    }
+    _read_ahead_thread->join();
+    _read_ahead_thread.reset();
+}
+
+void *StreamInputFile::read_ahead_function(StreamInputFile *file) {
+    name_current_thread("read-ahead");
+    // the stream of the file is used for synchronous reads at the same time, so the helper thread has its own
+    ifstream  stream(file->_filename, ios::binary);
+    uintmax_t range_size       = file->_read_ahead_end - file->_read_ahead_start;
+    uintmax_t number_of_blocks = (range_size + file->_block_size - 1) / file->_block_size;
+    for (uintmax_t number = 0; number < number_of_blocks; ++number) {
+        {
+            // wait until the block read "depth" blocks before has been released
+            pthread::unique_lock<pthread::mutex> lock(file->_mutex);
+            while (!file->_stop && number >= file->_blocks_released + file->_blocks.size()) {
+                file->_block_released.wait(lock);
+            }
+            if (file->_stop) {
+                break;
+            }
+        }
+        ReadAheadBlock &block       = file->_blocks[number % file->_blocks.size()];
+        uintmax_t       block_start = file->_read_ahead_start + number * file->_block_size;
+        uintmax_t       remaining   = file->_read_ahead_end - block_start;
+        size_t          size        = remaining < file->_block_size ? (size_t)remaining : file->_block_size;
+        block.buffer.resize(size);  // allocates only for the first blocks of a file
+        block.charge.set(block.buffer.capacity());
+        stream.clear();
+        stream.seekg(block_start);
+        stream.read((char *)block.buffer.data(), size);
+        block.has_failed = (size_t)stream.gcount() != size;
+
+        pthread::unique_lock<pthread::mutex> lock(file->_mutex);
+        file->_blocks_read = number + 1;
+        file->_block_read.notify_one();
+    }
+    return nullptr;
+}
+
+MappedInputFile::MappedInputFile()
+    : _data(nullptr)
+    , _released(0)
+    , _touched(UINTMAX_MAX)  // no pages are read before advise_sequential() has been called
+#if defined(_WIN32)
+    , _file_handle(INVALID_HANDLE_VALUE)
+    , _mapping_handle(nullptr)
+#endif
+{
+}
+
+#if defined(_WIN32)
+
+bool MappedInputFile::open(const fs::path &filename) {
+    _file_handle = CreateFileW(filename.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                               FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (_file_handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(_file_handle, &file_size)) {
+        return false;
+    }
+    _size = (uintmax_t)file_size.QuadPart;
+    if (_size == 0) {
+        return true;  // files of size 0 cannot be mapped but are valid nevertheless
+    }
+    _mapping_handle = CreateFileMappingW(_file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!_mapping_handle) {
+        return false;
+    }
+    _data = (const byte *)MapViewOfFile(_mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    return _data != nullptr;
+}
+
+MappedInputFile::~MappedInputFile() {
+    if (_data) {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping_handle) {
+        CloseHandle(_mapping_handle);
+    }
+    if (_file_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(_file_handle);
+    }
+}
+
+// Windows offers no equivalent of madvise() for mapped files,
+// FILE_FLAG_SEQUENTIAL_SCAN passed to CreateFileW() has to do
+void MappedInputFile::advise_sequential(const uintmax_t start, const uintmax_t /* size */) {
+    _touched = start;
+}
+
+void MappedInputFile::release_before(const uintmax_t position) {
+}
+
+#else
+
+bool MappedInputFile::open(const fs::path &filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat file_status;
+    if (fstat(fd, &file_status) != 0) {
+        close(fd);
+        return false;
+    }
+    _size = (uintmax_t)file_status.st_size;
+    if (_size == 0) {
+        close(fd);
+        return true;  // files of size 0 cannot be mapped but are valid nevertheless
+    }
+    void *data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping stays valid after closing the file descriptor
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    _data = (const byte *)data;
+    return true;
+}
+
+MappedInputFile::~MappedInputFile() {
+    if (_data) {
+        munmap((void *)_data, _size);
+    }
+}
+
+void MappedInputFile::advise_sequential(const uintmax_t start, const uintmax_t size) {
+    _touched = start;
+    if (!_data || start >= _size) {
+        return;
+    }
+    // madvise() requires a page aligned address
+    uintmax_t page_size    = (uintmax_t)sysconf(_SC_PAGESIZE);
+    uintmax_t page_start   = start / page_size * page_size;
+    uintmax_t end          = size > _size - start ? _size : start + size;
+    madvise((void *)(_data + page_start), end - page_start, MADV_SEQUENTIAL);
+}
+
+void MappedInputFile::release_before(const uintmax_t position) {
+    if (!_data) {
+        return;
+    }
+    // only release whole pages so that the page containing "position" stays untouched
+    uintmax_t page_size = (uintmax_t)sysconf(_SC_PAGESIZE);
+    uintmax_t page_end  = (position < _size ? position : _size) / page_size * page_size;
+    if (page_end > _released) {
+        madvise((void *)(_data + _released), page_end - _released, MADV_DONTNEED);
+        _released = page_end;
+    }
+}
+
+#endif  // _WIN32
+
+const byte *MappedInputFile::view(const uintmax_t start, const size_t size) {
+    if (start > _size || size > _size - start) {
+        return nullptr;
+    }
+    return _data + start;
+}
+
+void MappedInputFile::touch(const uintmax_t start, const size_t size) {
+    if (start > _size || size > _size - start) {
+        return;
+    }
+    // the smallest page size of the supported platforms, with larger pages some are read more than once
+    const uintmax_t page_size = 4096;
+    uintmax_t       offset    = start > _touched ? start : _touched;
+    uintmax_t       end       = start + size;
+    volatile byte   sink      = byte(0);
+    while (offset < end) {
+        sink   = _data[offset];
+        offset = (offset / page_size + 1) * page_size;
+    }
+    (void)sink;
+    if (end > _touched) {
+        _touched = end;
+    }
+}
+
+UringInputFile::UringInputFile()
+    : _fd(-1)
+    , _ring(nullptr)
+    , _blocks(Configuration::read_ahead())
+    , _current_block(nullptr)
+    , _read_ahead_position(0)
+    , _read_ahead_end(0)
+    , _block_size(0) {
+}
+
+#ifdef WAV2MP3_HAS_IO_URING
+
+UringInputFile::~UringInputFile() {
+    // the kernel may still write into the buffers of blocks in flight, so they are kept until it is done with them
+    for (auto &block : _blocks) {
+        if (block.request.in_flight) {
+            _ring->retire(block.request, block.buffer);
+        }
+    }
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+bool UringInputFile::open(const fs::path &filename) {
+    if (!IoUring::is_supported()) {
+        return false;
+    }
+    _fd = ::open(filename.c_str(), O_RDONLY);
+    if (_fd < 0) {
+        return false;
+    }
+    struct stat file_status;
+    if (fstat(_fd, &file_status) != 0) {
+        return false;
+    }
+    _size = (uintmax_t)file_status.st_size;
+    return true;
+}
+
+void UringInputFile::advise_sequential(const uintmax_t start, const uintmax_t size) {
+    if (start >= _size) {
+        return;
+    }
+    _read_ahead_position = start;
+    _read_ahead_end      = size > _size - start ? _size : start + size;
+    _block_size          = 0;
+}
+
+const byte *UringInputFile::view(const uintmax_t start, const size_t size) {
+    if (start > _size || size > _size - start) {
+        return nullptr;
+    }
+    // the block the previous view pointed into is not needed anymore, so reuse it for reading ahead
+    if (_current_block) {
+        submit_read_ahead(*_current_block);
+        _current_block = nullptr;
+    }
+    // the first view into the advised range defines the block size and starts reading ahead
+    if (_block_size == 0 && start == _read_ahead_position && start < _read_ahead_end && size > 0
+        && size <= INT32_MAX) {
+        _block_size = size;
+        _ring       = &IoUring::of_current_thread();
+        for (auto &block : _blocks) {
+            submit_read_ahead(block);
+        }
+    }
+    if (_ring) {
+        _ring->submit();
+    }
+    for (auto &block : _blocks) {
+        if (block.size > 0 && start >= block.start && start + size <= block.start + block.size) {
+            if (wait_for(block)) {
+                _current_block = &block;
+                return block.buffer.data() + (start - block.start);
+            }
+            break;  // reading ahead failed, try it once more synchronously to get a meaningful result
+        }
+    }
+    // blocks read ahead take precedence over the head window, so that they are reused
+    if (const byte *head = view_head_window(start, size)) {
+        return head;
+    }
+    _buffer.resize(size);
+    _buffer_charge.set(_buffer.capacity());
+    return read(_buffer.data(), start, size) ? _buffer.data() : nullptr;
+}
+
+bool UringInputFile::submit_read_ahead(ReadAheadBlock &block) {
+    if (_block_size == 0 || _read_ahead_position >= _read_ahead_end) {
+        return false;
+    }
+    uintmax_t remaining = _read_ahead_end - _read_ahead_position;
+    block.start         = _read_ahead_position;
+    block.size          = remaining < _block_size ? (size_t)remaining : _block_size;
+    block.buffer.resize(block.size);  // allocates only for the first blocks of a file
+    block.charge.set(block.buffer.capacity());
+    if (!_ring->prepare_read(_fd, block.buffer.data(), (uint32_t)block.size, block.start, block.request)) {
+        block.size = 0;
+        return false;
+    }
+    _read_ahead_position += block.size;
+    return true;
+}
+
+bool UringInputFile::wait_for(ReadAheadBlock &block) {
+    IoRequest &request = block.request;
+    if (request.in_flight && !_ring->wait_for(request)) {
+        return false;
+    }
+    if (request.result < 0) {
+        return false;
+    }
+    // read requests may complete with less bytes than requested, in that case read the rest synchronously
+    if ((size_t)request.result < block.size) {
+        if (!read(block.buffer.data() + request.result, block.start + request.result, block.size - request.result)) {
+            return false;
+        }
+        request.result = (int32_t)block.size;
+    }
+    return true;
+}
+
+bool UringInputFile::read(byte *buffer, const uintmax_t start, const size_t size) {
+    size_t bytes_read = 0;
+    while (bytes_read < size) {
+        ssize_t ret = pread(_fd, buffer + bytes_read, size - bytes_read, (off_t)(start + bytes_read));
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        bytes_read += (size_t)ret;
+    }
+    return true;
+}
+
+#else  // WAV2MP3_HAS_IO_URING
+
+UringInputFile::~UringInputFile() {
+}
+
+bool UringInputFile::open(const fs::path &filename) {
+    return false;
+}
+
+void UringInputFile::advise_sequential(const uintmax_t start, const uintmax_t size) {
+}
+
+const byte *UringInputFile::view(const uintmax_t start, const size_t size) {
+    return nullptr;
+}
+
+bool UringInputFile::read(byte *buffer, const uintmax_t start, const size_t size) {
+    return false;
+}
+
+#endif  // WAV2MP3_HAS_IO_URING
@@ -0,0 +1,223 @@
+//
+// declares class InputFile giving read access to the content of a WAV file as views on its bytes
+// Three implementations are available, selected by Configuration::input_backend():
+//     - StreamInputFile: reads the requested bytes into an internal buffer using an std::ifstream, the audio data
+//       is read ahead by a helper thread while the previous blocks are being encoded
+//     - MappedInputFile: maps the whole file into memory, so views point directly into the mapping
+//       without any copying
+//     - UringInputFile: keeps several blocks of the audio data read ahead asynchronously using io_uring
+//       (Linux only, falls back to StreamInputFile if io_uring is not available)
+//
+
+#ifndef INPUT_FILE_H
+#define INPUT_FILE_H
+
+#include "configuration.h"
+#include "io_uring.h"
+#include "memory_budget.h"
+
+#include "thread_includes.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>  // forward declarations could be used here but they can be very error prone, see:
+                       // https://google.github.io/styleguide/cppguide.html#Forward_Declarations
+#include <fstream>
+#include <memory>
+#include <vector>
+
+class InputFile {
+  public:
+    virtual ~InputFile();
+
+    // creates an InputFile instance of the implementation matching the passed backend
+    // and opens the file "filename" for reading
+    // returns nullptr if opening the file fails
+    static std::shared_ptr<InputFile> open(const std::filesystem::path &filename, const InputBackend backend);
+
+    // returns the memory the buffers of an InputFile of "backend" need at most for a file of "file_size" bytes
+    // viewed in blocks of at most "block_size" bytes, see MemoryBudget
+    static std::uintmax_t memory_needed(const InputBackend backend, const std::size_t block_size,
+                                        const std::uintmax_t file_size = UINTMAX_MAX);
+
+    // returns the size of the file in bytes
+    std::uintmax_t size() const;
+
+    // returns a pointer to the "size" bytes of the file starting at byte offset "start"
+    // returns nullptr if the file does not contain that many bytes from "start" on
+    // The pointer stays valid until the next call of view()
+    virtual const std::byte *view(const std::uintmax_t start, const std::size_t size) = 0;
+
+    // hint that the "size" bytes starting at "start" are going to be read sequentially
+    virtual void advise_sequential(const std::uintmax_t start, const std::uintmax_t size);
+
+    // hint that the bytes before "position" are not going to be read again
+    virtual void release_before(const std::uintmax_t position);
+
+    // makes sure the "size" bytes starting at "start" viewed before are read from the file now and not on their
+    // first access, so the time reading them can be measured, see ActivityTimer
+    // Only needed by implementations whose views are not read by view() itself
+    virtual void touch(const std::uintmax_t start, const std::size_t size);
+
+  protected:
+    InputFile();
+
+    // returns a pointer into the head window if it contains the requested range, otherwise nullptr
+    // The first call reads the head window using read()
+    const std::byte *view_head_window(const std::uintmax_t start, const std::size_t size);
+
+    // reads "size" bytes starting at file offset "start" into "buffer", returns false on failure
+    // must be implemented by the implementations using view_head_window()
+    virtual bool read(std::byte *buffer, const std::uintmax_t start, const std::size_t size);
+
+    // size of the window at the beginning of the file the implementations reading into buffers read at once on the
+    // first call of view(). So usually all chunk headers and the "fmt " and "LIST" chunks can be parsed from memory
+    // and probing a file costs a single read
+    static const std::size_t head_window_size = 64 * 1024;
+
+    std::uintmax_t         _size;
+    std::vector<std::byte> _head_window;       // the first bytes of the file
+    MemoryCharge           _head_window_charge;
+    bool                   _head_window_read;  // true after the first call of view_head_window()
+};
+
+// InputFile implementation reading the requested bytes into an internal buffer using an std::ifstream
+// Views into the head window are served without reading.
+// After advise_sequential() has been called the first view() into the advised range defines the block size and
+// starts a helper thread reading the following blocks into a ring of Configuration::read_ahead() blocks. So the
+// next blocks are being read while the current one is being encoded, the helper thread waits while the ring is full.
+// A block stays in the ring until a view() into a later block, so views stay valid until the next call of view().
+// A range the ring could hold as a whole is read at once by the first view() instead, since for short files starting
+// the helper thread and opening the file once more for it costs more than reading ahead saves
+class StreamInputFile : public InputFile {
+  public:
+    StreamInputFile();
+    ~StreamInputFile() override;
+
+    StreamInputFile(const StreamInputFile &) = delete;
+    StreamInputFile &operator=(const StreamInputFile &) = delete;
+
+    // opens the file "filename", returns false on failure
+    bool open(const std::filesystem::path &filename);
+
+    const std::byte *view(const std::uintmax_t start, const std::size_t size) override;
+    void             advise_sequential(const std::uintmax_t start, const std::uintmax_t size) override;
+
+  protected:
+    bool read(std::byte *buffer, const std::uintmax_t start, const std::size_t size) override;
+
+  private:
+    // reads the "size" bytes starting at "start" into _buffer, returns a pointer to them or nullptr on failure
+    const std::byte *fill_buffer(const std::uintmax_t start, const std::size_t size);
+
+    typedef struct ReadAheadBlock {
+        std::vector<std::byte> buffer;
+        MemoryCharge           charge;
+        bool                   has_failed = false;  // reading failed, the block is read again synchronously
+    } ReadAheadBlock;
+
+    // returns a pointer into the block read ahead containing the "size" bytes starting at "start"
+    // and releases the blocks before it, returns nullptr if no such block is read ahead
+    const std::byte *view_read_ahead(const std::uintmax_t start, const std::size_t size);
+    // stops the helper thread and waits for it to terminate
+    void stop_read_ahead();
+    // function executed by the helper thread reading the blocks of the advised range one after the other
+    static void *read_ahead_function(StreamInputFile *file);
+
+  private:
+    std::filesystem::path  _filename;
+    std::ifstream          _stream;
+    std::vector<std::byte> _buffer;        // contains the bytes read last
+    MemoryCharge           _buffer_charge;
+    std::uintmax_t         _buffer_start;  // file position of the first byte in _buffer
+
+    std::vector<ReadAheadBlock>      _blocks;             // block n of the advised range is kept in _blocks[n % size]
+    std::uintmax_t                   _read_ahead_start;   // start of the range passed to advise_sequential()
+    std::uintmax_t                   _read_ahead_end;     // end of the range passed to advise_sequential()
+    std::size_t                      _block_size;         // 0 until the first view() into the advised range
+    std::uintmax_t                   _blocks_read;        // number of blocks of the range read by the helper thread
+    std::uintmax_t                   _blocks_released;    // number of blocks of the range not viewed anymore
+    bool                             _stop;               // tells the helper thread to terminate
+    std::unique_ptr<pthread::thread> _read_ahead_thread;  // the helper thread, nullptr if not reading ahead
+    pthread::mutex                   _mutex;              // protects _blocks_read, _blocks_released and _stop
+    pthread::condition_variable      _block_read;         // notified by the helper thread after reading a block
+    pthread::condition_variable      _block_released;     // notified when blocks have been released or on stop
+};
+
+// InputFile implementation mapping the whole file into the address space of the process
+class MappedInputFile : public InputFile {
+  public:
+    MappedInputFile();
+    ~MappedInputFile() override;
+
+    MappedInputFile(const MappedInputFile &) = delete;
+    MappedInputFile &operator=(const MappedInputFile &) = delete;
+
+    // opens and maps the file "filename", returns false on failure
+    bool open(const std::filesystem::path &filename);
+
+    const std::byte *view(const std::uintmax_t start, const std::size_t size) override;
+    // uses madvise(MADV_SEQUENTIAL) to make the kernel read ahead aggressively
+    void advise_sequential(const std::uintmax_t start, const std::uintmax_t size) override;
+    // uses madvise(MADV_DONTNEED) to drop the already processed pages from the page cache mapping
+    void release_before(const std::uintmax_t position) override;
+    // reads a byte of every page of the advised range not touched before, so their page faults happen here
+    void touch(const std::uintmax_t start, const std::size_t size) override;
+
+  private:
+    const std::byte *_data;
+    std::uintmax_t   _released;  // all whole pages before this position have already been released
+    std::uintmax_t   _touched;   // the advised pages before this position have already been read by touch()
+#if defined(_WIN32)
+    void *_file_handle;
+    void *_mapping_handle;
+#endif
+};
+
+// InputFile implementation reading the audio data asynchronously using io_uring
+// After advise_sequential() has been called the first view() into the advised range defines the block size.
+// From then on Configuration::read_ahead() consecutive blocks are kept in flight, so that the views of the following
+// blocks usually find their data already read. All other views are served from the head window
+// or by synchronous reads. The requests are submitted to the io_uring of the thread calling view(), so from the
+// first view into the advised range on the file must be read by that thread only. If it is destroyed by another
+// thread while blocks are read ahead, their buffers are leaked, since only that thread can wait for them.
+class UringInputFile : public InputFile {
+  public:
+    UringInputFile();
+    ~UringInputFile() override;
+
+    UringInputFile(const UringInputFile &) = delete;
+    UringInputFile &operator=(const UringInputFile &) = delete;
+
+    // opens the file "filename", returns false on failure or if the kernel does not support io_uring
+    bool open(const std::filesystem::path &filename);
+
+    const std::byte *view(const std::uintmax_t start, const std::size_t size) override;
+    void             advise_sequential(const std::uintmax_t start, const std::uintmax_t size) override;
+
+  private:
+    typedef struct ReadAheadBlock {
+        std::vector<std::byte> buffer;
+        MemoryCharge           charge;
+        std::uintmax_t         start = 0;
+        std::size_t            size  = 0;
+        IoRequest              request;
+    } ReadAheadBlock;
+
+    bool read(std::byte *buffer, const std::uintmax_t start, const std::size_t size) override;
+    bool submit_read_ahead(ReadAheadBlock &block);
+    bool wait_for(ReadAheadBlock &block);
+
+  private:
+    int                         _fd;
+    IoUring *                   _ring;  // io_uring of the thread reading ahead, nullptr until reading ahead starts
+    std::vector<ReadAheadBlock> _blocks;
+    ReadAheadBlock *            _current_block;         // block the last view() pointed into, reused by next view()
+    std::uintmax_t              _read_ahead_position;   // file offset of the next block to read ahead
+    std::uintmax_t              _read_ahead_end;        // end of the range passed to advise_sequential()
+    std::size_t                 _block_size;            // 0 until the first view() into the advised range
+    std::vector<std::byte>      _buffer;                // buffer for synchronous reads
+    MemoryCharge                _buffer_charge;
+};
+
+#endif  // INPUT_FILE_H
@@ -0,0 +1,313 @@
+#include "io_uring.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#ifdef WAV2MP3_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+using namespace std;
+
+// number of requests the instance of a thread can queue, more are submitted before queuing further ones
+static const unsigned thread_ring_entries = 64;
+
+// the instance of the calling thread, nullptr until of_current_thread() has set it up
+static thread_local const IoUring *current_thread_ring = nullptr;
+
+IoUring &IoUring::of_current_thread() {
+    thread_local IoUring ring(thread_ring_entries);
+    current_thread_ring = &ring;
+    return ring;
+}
+
+bool IoUring::is_of_current_thread() const {
+    return this == current_thread_ring;
+}
+
+void IoUring::retire(IoRequest &request, vector<byte> &buffer) {
+    if (!request.in_flight) {
+        return;
+    }
+    if (!is_of_current_thread()) {
+        // the kernel may still access the buffer, but the request cannot be waited for by this thread
+        (void)new vector<byte>(move(buffer));  // leaked on purpose
+        request.in_flight = false;
+        return;
+    }
+    if (wait_for(request)) {
+        return;
+    }
+    RequestSlot &slot = _slots[request.slot];
+    if (slot.completed) {
+        release_slot(request.slot);
+    } else {
+        slot.abandoned = true;
+        slot.buffer    = move(buffer);
+    }
+    request.in_flight = false;
+}
+
+void IoUring::release_slot(const uint32_t slot) {
+    _slots[slot] = RequestSlot();
+    _free_slots.push_back(slot);
+}
+
+#ifdef WAV2MP3_HAS_IO_URING
+
+IoUring::IoUring(const unsigned entries)
+    : _fd(-1)
+    , _to_submit(0)
+    , _sq_ring(MAP_FAILED)
+    , _cq_ring(MAP_FAILED)
+    , _sq_ring_size(0)
+    , _cq_ring_size(0)
+    , _sqes(MAP_FAILED)
+    , _sqes_size(0)
+    , _in_flight(0) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    _fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (_fd < 0) {
+        return;
+    }
+    // map the submission and the completion queue rings, since kernel 5.4 both share one mapping
+    _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        _sq_ring_size = _cq_ring_size = _sq_ring_size > _cq_ring_size ? _sq_ring_size : _cq_ring_size;
+    }
+    _sq_ring =
+        mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) {
+        return;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        _cq_ring = _sq_ring;
+    } else {
+        _cq_ring =
+            mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        if (_cq_ring == MAP_FAILED) {
+            return;
+        }
+    }
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes      = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+        return;
+    }
+    char *sq_ring = (char *)_sq_ring;
+    char *cq_ring = (char *)_cq_ring;
+    _sq_head      = (unsigned *)(sq_ring + params.sq_off.head);
+    _sq_tail      = (unsigned *)(sq_ring + params.sq_off.tail);
+    _sq_mask      = *(unsigned *)(sq_ring + params.sq_off.ring_mask);
+    _sq_entries   = *(unsigned *)(sq_ring + params.sq_off.ring_entries);
+    _sq_array     = (unsigned *)(sq_ring + params.sq_off.array);
+    _cq_head      = (unsigned *)(cq_ring + params.cq_off.head);
+    _cq_tail      = (unsigned *)(cq_ring + params.cq_off.tail);
+    _cq_mask      = *(unsigned *)(cq_ring + params.cq_off.ring_mask);
+    _cqes         = cq_ring + params.cq_off.cqes;
+}
+
+IoUring::~IoUring() {
+    // the kernel may still access the buffers of abandoned requests, so wait for them before releasing the buffers
+    while (_in_flight > 0) {
+        if (!complete_next()) {
+            (void)new vector<RequestSlot>(move(_slots));  // leaked on purpose
+            break;
+        }
+    }
+    if (_sqes != MAP_FAILED) {
+        munmap(_sqes, _sqes_size);
+    }
+    if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) {
+        munmap(_cq_ring, _cq_ring_size);
+    }
+    if (_sq_ring != MAP_FAILED) {
+        munmap(_sq_ring, _sq_ring_size);
+    }
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+bool IoUring::is_supported() {
+    // IORING_OP_READ and IORING_OP_WRITE are available since kernel 5.6,
+    // which is also the first version reporting IORING_FEAT_RW_CUR_POS
+    static const bool supported = []() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = (int)syscall(__NR_io_uring_setup, 1, &params);
+        if (fd < 0) {
+            return false;
+        }
+        close(fd);
+        return (params.features & IORING_FEAT_RW_CUR_POS) != 0;
+    }();
+    return supported;
+}
+
+bool IoUring::is_initialized() const {
+    return _sqes != MAP_FAILED;
+}
+
+bool IoUring::prepare(const uint8_t opcode, const int fd, const void *buffer, const uint32_t size,
+                      const uint64_t offset, IoRequest &request) {
+    if (!is_initialized()) {
+        return false;
+    }
+    // the kernel only reads the tail of the submission queue, so it can be read without synchronization
+    unsigned tail = *_sq_tail;
+    if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) == _sq_entries) {
+        // the kernel takes the queued requests on submission, which makes room for more
+        if (!enter(0) || tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) == _sq_entries) {
+            return false;
+        }
+    }
+    uint32_t slot;
+    if (_free_slots.empty()) {
+        slot = (uint32_t)_slots.size();
+        _slots.emplace_back();
+    } else {
+        slot = _free_slots.back();
+        _free_slots.pop_back();
+    }
+    unsigned      index = tail & _sq_mask;
+    io_uring_sqe *sqe   = (io_uring_sqe *)_sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode      = opcode;
+    sqe->fd          = fd;
+    sqe->addr        = (uint64_t)(uintptr_t)buffer;
+    sqe->len         = size;
+    sqe->off         = offset;
+    sqe->user_data   = slot;
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++_to_submit;
+    ++_in_flight;
+    request.in_flight = true;
+    request.slot      = slot;
+    return true;
+}
+
+bool IoUring::prepare_read(const int fd, void *buffer, const uint32_t size, const uint64_t offset,
+                           IoRequest &request) {
+    return prepare(IORING_OP_READ, fd, buffer, size, offset, request);
+}
+
+bool IoUring::prepare_write(const int fd, const void *buffer, const uint32_t size, const uint64_t offset,
+                            IoRequest &request) {
+    return prepare(IORING_OP_WRITE, fd, buffer, size, offset, request);
+}
+
+bool IoUring::enter(const unsigned min_complete) {
+    while (true) {
+        int ret = (int)syscall(__NR_io_uring_enter, _fd, _to_submit, min_complete,
+                               min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (ret >= 0) {
+            _to_submit -= (unsigned)ret;
+            return true;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+bool IoUring::submit() {
+    return _to_submit == 0 || enter(0);
+}
+
+bool IoUring::pop_completion(uint64_t &user_data, int32_t &result) {
+    // only the kernel writes the tail and only this process writes the head of the completion queue
+    unsigned head = *_cq_head;
+    if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    const io_uring_cqe *cqe = (const io_uring_cqe *)_cqes + (head & _cq_mask);
+    user_data               = cqe->user_data;
+    result                  = cqe->res;
+    __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool IoUring::complete_next() {
+    uint64_t user_data;
+    int32_t  result;
+    while (!pop_completion(user_data, result)) {
+        if (!enter(1)) {
+            return false;
+        }
+    }
+    // the completion may belong to a request of another file of the same thread
+    --_in_flight;
+    RequestSlot &slot = _slots[(size_t)user_data];
+    if (slot.abandoned) {
+        vector<byte>().swap(slot.buffer);  // the kernel is done with it now
+        release_slot((uint32_t)user_data);
+    } else {
+        slot.completed = true;
+        slot.result    = result;
+    }
+    return true;
+}
+
+bool IoUring::wait_for(IoRequest &request) {
+    if (!request.in_flight) {
+        return true;
+    }
+    while (!_slots[request.slot].completed) {
+        if (!complete_next()) {
+            return false;
+        }
+    }
+    request.result    = _slots[request.slot].result;
+    request.in_flight = false;
+    release_slot(request.slot);
+    return true;
+}
+
+#else  // WAV2MP3_HAS_IO_URING
+
+IoUring::IoUring(const unsigned entries)
+    : _fd(-1)
+    , _in_flight(0) {
+}
+
+IoUring::~IoUring() {
+}
+
+bool IoUring::is_supported() {
+    return false;
+}
+
+bool IoUring::is_initialized() const {
+    return false;
+}
+
+bool IoUring::prepare_read(const int fd, void *buffer, const uint32_t size, const uint64_t offset,
+                           IoRequest &request) {
+    return false;
+}
+
+bool IoUring::prepare_write(const int fd, const void *buffer, const uint32_t size, const uint64_t offset,
+                            IoRequest &request) {
+    return false;
+}
+
+bool IoUring::submit() {
+    return false;
+}
+
+bool IoUring::wait_for(IoRequest &request) {
+    return !request.in_flight;
+}
+
+#endif  // WAV2MP3_HAS_IO_URING
@@ -0,0 +1,124 @@
+//
+// declares class IoUring, a minimal wrapper around the Linux io_uring interface for asynchronous file I/O
+// Only the few operations needed by UringInputFile and UringOutputFile are supported: reading and writing
+// blocks at explicit file offsets and waiting for their completion
+// Setting up an instance takes a system call and three mappings, which would cost more than reading a small file,
+// so every thread sets up one instance on first use and all files it reads or writes share it. Every request in
+// flight takes a slot of a table of the instance, which is passed to the kernel and receives the result on
+// completion, so requests of several files can be in flight. A completion is never stored into an IoRequest that
+// may already be freed, the result is only copied into it by wait_for() called with it.
+// An instance must only be used by its thread, including the waiting before a file releases its buffers, see retire()
+// The system calls are used directly, so liburing is not required.
+// On other platforms or if the kernel headers lack io_uring support the class is available
+// but IoUring::is_supported() always returns false
+//
+
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define WAV2MP3_HAS_IO_URING
+#endif
+#endif
+
+// a read or write request, the result is stored in it when it is waited for
+typedef struct IoRequest {
+    bool          in_flight = false;
+    std::int32_t  result    = 0;  // number of bytes transferred or -errno
+    std::uint32_t slot      = 0;  // slot of the request table of the IoUring while in flight
+} IoRequest;
+
+class IoUring {
+  public:
+    // sets up an io_uring instance with room for "entries" requests in flight
+    // use is_initialized() to check if that succeeded
+    explicit IoUring(const unsigned entries);
+    ~IoUring();
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    // returns the instance of the calling thread, which is set up on the first call
+    // A request must be waited for by the thread which submitted it
+    static IoUring &of_current_thread();
+
+    // returns true if the running kernel supports all io_uring features needed
+    // the check is done only once per process
+    static bool is_supported();
+
+    bool is_initialized() const;
+
+    // returns true if this is the instance of the calling thread
+    bool is_of_current_thread() const;
+
+    // queue reading "size" bytes at file offset "offset" of file descriptor "fd" into "buffer"
+    // or writing them from "buffer". "request" is marked in flight and receives the result from wait_for()
+    // returns false if the instance is not initialized or the request could not be queued
+    bool prepare_read(const int fd, void *buffer, const std::uint32_t size, const std::uint64_t offset,
+                      IoRequest &request);
+    bool prepare_write(const int fd, const void *buffer, const std::uint32_t size, const std::uint64_t offset,
+                       IoRequest &request);
+
+    // submits all queued requests to the kernel without waiting
+    // returns false on failure
+    bool submit();
+
+    // submits all queued requests and waits until "request" is not in flight anymore
+    // the results of the other requests completing meanwhile are kept until they are waited for
+    // returns false on failure
+    bool wait_for(IoRequest &request);
+
+    // to be called before "buffer" read into or written from by "request" is released, waits for "request"
+    // If waiting fails, the instance takes "buffer" over and releases it when the kernel has completed the request.
+    // Called by another thread than the one of the instance, which must not use it, "buffer" is leaked instead
+    void retire(IoRequest &request, std::vector<std::byte> &buffer);
+
+  private:
+    // an entry of the request table, "completed" and "result" are set on completion
+    // The buffer of an abandoned request nobody waits for anymore is kept until the request completes
+    typedef struct RequestSlot {
+        bool                   completed = false;
+        bool                   abandoned = false;
+        std::int32_t           result    = 0;
+        std::vector<std::byte> buffer;
+    } RequestSlot;
+
+    bool prepare(const std::uint8_t opcode, const int fd, const void *buffer, const std::uint32_t size,
+                 const std::uint64_t offset, IoRequest &request);
+    bool enter(const unsigned min_complete);
+    bool pop_completion(std::uint64_t &user_data, std::int32_t &result);
+    // stores the next completion in the slot of its request, waits for one if none is available
+    // returns false on failure
+    bool complete_next();
+    void release_slot(const std::uint32_t slot);
+
+  private:
+    int            _fd;
+    unsigned       _to_submit;  // number of queued requests not yet passed to the kernel
+    void *         _sq_ring;
+    void *         _cq_ring;
+    std::size_t    _sq_ring_size;
+    std::size_t    _cq_ring_size;
+    void *         _sqes;
+    std::size_t    _sqes_size;
+    unsigned *     _sq_head;
+    unsigned *     _sq_tail;
+    unsigned       _sq_mask;
+    unsigned       _sq_entries;
+    unsigned *     _sq_array;
+    unsigned *     _cq_head;
+    unsigned *     _cq_tail;
+    unsigned       _cq_mask;
+    void *         _cqes;
+
+    std::vector<RequestSlot>   _slots;       // grows to the most requests ever in flight at once
+    std::vector<std::uint32_t> _free_slots;  // indexes of the slots not in use
+    std::size_t                _in_flight;   // number of requests not completed yet
+};
+
+#endif  // IO_URING_H
@@ -47,7 +47,7 @@ LameInit::operator lame_global_flags *() const {
     return lgf;
 }
 
-void LameInit::check_error(int errnum, const string lame_function_name, bool throw_exception) {
+void LameInit::check_error(int errnum, const char *lame_function_name, bool throw_exception) {
     // all error codes of lame are < 0 since returned values > 0 usually
     // mean e.g. the number of converted bytes
     if (errnum < 0) {
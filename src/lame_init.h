@@ -30,7 +30,7 @@ class LameInit {
     // checks if errnum is a valid lame error (means: < 0).
     // If yes then either print an error message to tcerr if throw_exception == false
     // or throws a lame_exception with the error message
-    static void check_error(int errnum, const std::string lame_function_name, bool throw_exception = true);
+    static void check_error(int errnum, const char *lame_function_name, bool throw_exception = true);
 
     // maps lame error number to descriptive string
     static std::map<int, std::string> lame_error_map;
@@ -0,0 +1,145 @@
+#include "memory_budget.h"
+#include "configuration.h"
+
+#include <algorithm>
+
+using namespace std;
+
+pthread::mutex              MemoryBudget::_mutex;
+pthread::condition_variable MemoryBudget::_released;
+uintmax_t                   MemoryBudget::_reserved      = 0;
+uintmax_t                   MemoryBudget::_set_aside     = 0;
+uintmax_t                   MemoryBudget::_peak_reserved = 0;
+atomic<size_t>              MemoryBudget::_waiters(0);
+atomic<intmax_t>            MemoryBudget::_allocated(0);
+atomic<intmax_t>            MemoryBudget::_peak_allocated(0);
+
+uintmax_t MemoryBudget::limit() {
+    return Configuration::memory_limit();
+}
+
+void MemoryBudget::set_aside(const uintmax_t bytes) {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    _reserved += bytes;
+    _set_aside += bytes;
+    _peak_reserved = max(_peak_reserved, _reserved);
+}
+
+bool MemoryBudget::has_waiters() {
+    return _waiters > 0;
+}
+
+uintmax_t MemoryBudget::peak_reserved() {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    return _peak_reserved;
+}
+
+uintmax_t MemoryBudget::peak_allocated() {
+    return (uintmax_t)max(_peak_allocated.load(), (intmax_t)0);
+}
+
+void MemoryBudget::reserve(const uintmax_t bytes, const uintmax_t held, const function<void()> &before_waiting) {
+    uintmax_t limit = MemoryBudget::limit();
+    // the waiter is counted before "before_waiting" is called, so memory held back by others after that, like
+    // a batch of files not enqueued yet, is passed on when they check has_waiters()
+    bool waiting = false;
+    while (true) {
+        {
+            pthread::unique_lock<pthread::mutex> lock(_mutex);
+            if (limit == 0 || _reserved + bytes <= limit || _reserved - _set_aside <= held) {
+                _reserved += bytes;
+                _peak_reserved = max(_peak_reserved, _reserved);
+                break;
+            }
+            if (waiting) {
+                _released.wait(lock);
+                continue;
+            }
+            waiting = true;
+            ++_waiters;
+        }
+        if (before_waiting) {
+            before_waiting();
+        }
+    }
+    if (waiting) {
+        --_waiters;
+    }
+}
+
+bool MemoryBudget::try_reserve(const uintmax_t bytes) {
+    uintmax_t                            limit = MemoryBudget::limit();
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    if (limit > 0 && _reserved + bytes > limit) {
+        return false;
+    }
+    _reserved += bytes;
+    _peak_reserved = max(_peak_reserved, _reserved);
+    return true;
+}
+
+void MemoryBudget::release(const uintmax_t bytes) {
+    if (bytes == 0) {
+        return;
+    }
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    _reserved -= bytes;
+    _released.notify_all();
+}
+
+void MemoryBudget::charge(const intmax_t bytes) {
+    intmax_t allocated = _allocated.fetch_add(bytes, memory_order_relaxed) + bytes;
+    intmax_t peak      = _peak_allocated.load(memory_order_relaxed);
+    while (allocated > peak && !_peak_allocated.compare_exchange_weak(peak, allocated, memory_order_relaxed)) {
+    }
+}
+
+MemoryReservation::MemoryReservation()
+    : _bytes(0) {
+}
+
+MemoryReservation::~MemoryReservation() {
+    MemoryBudget::release(_bytes);
+}
+
+void MemoryReservation::reserve(const uintmax_t bytes, const function<void()> &before_waiting) {
+    MemoryBudget::reserve(bytes, _bytes, before_waiting);
+    _bytes += bytes;
+}
+
+bool MemoryReservation::try_reserve(const uintmax_t bytes) {
+    if (!MemoryBudget::try_reserve(bytes)) {
+        return false;
+    }
+    _bytes += bytes;
+    return true;
+}
+
+void MemoryReservation::resize(const uintmax_t bytes) {
+    if (bytes > _bytes) {
+        // as if all memory reserved was held by the caller, so it never waits
+        MemoryBudget::reserve(bytes - _bytes, UINTMAX_MAX, nullptr);
+    } else {
+        MemoryBudget::release(_bytes - bytes);
+    }
+    _bytes = bytes;
+}
+
+uintmax_t MemoryReservation::size() const {
+    return _bytes;
+}
+
+MemoryCharge::MemoryCharge()
+    : _bytes(0) {
+}
+
+MemoryCharge::~MemoryCharge() {
+    set(0);
+}
+
+void MemoryCharge::set(const size_t bytes) {
+    if (bytes != _bytes) {
+        MemoryBudget::charge((intmax_t)bytes - (intmax_t)_bytes);
+        _bytes = bytes;
+    }
+}
@@ -0,0 +1,111 @@
+//
+// declares class MemoryBudget limiting the memory of the buffers of the files in flight
+// to Configuration::memory_limit()
+// Every file being converted needs buffers for reading the WAV file ahead and for collecting the MP3 data, and the
+// task converting it carries copies of the meta data. Without a limit the number of files in flight grows with the
+// look-ahead, the batches and the segments, so does the memory.
+// Two amounts are tracked:
+//     - reserved: the memory a file is estimated to need at most, reserved by a MemoryReservation before the file is
+//       dispatched and released after it has been converted. Dispatching waits while the reservations would exceed
+//       the limit, so the memory in flight stays below it
+//     - allocated: the memory actually allocated for buffers on the conversion path, charged by a MemoryCharge
+//       owned by the buffer, for checking the estimates against
+// The peaks of both are reported at the end.
+// Dispatching only waits if other files are in flight, so a single file needing more than the limit is converted
+// on its own instead of waiting forever. Memory set aside for the whole run, like the buffers of the threads, is
+// not counted as in flight for that rule
+//
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include "thread_includes.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+class MemoryBudget {
+  public:
+    // returns the limit of the memory reserved in bytes, 0 if there is none, see Configuration::memory_limit()
+    static std::uintmax_t limit();
+
+    // sets "bytes" aside for the whole run without waiting, e.g. for the buffers of the threads
+    static void set_aside(const std::uintmax_t bytes);
+
+    // returns true if a thread is waiting in MemoryReservation::reserve() for memory to be released
+    static bool has_waiters();
+
+    // the highest amounts of memory reserved and allocated at the same time in bytes
+    static std::uintmax_t peak_reserved();
+    static std::uintmax_t peak_allocated();
+
+  private:
+    friend class MemoryReservation;
+    friend class MemoryCharge;
+
+    // reserves "bytes", waits while that would exceed the limit and more than "held" bytes are reserved
+    // for files in flight. "before_waiting" is called outside of the lock before waiting the first time
+    static void reserve(const std::uintmax_t bytes, const std::uintmax_t held,
+                        const std::function<void()> &before_waiting);
+    // reserves "bytes" if that does not exceed the limit, returns false otherwise
+    static bool try_reserve(const std::uintmax_t bytes);
+    static void release(const std::uintmax_t bytes);
+    // adds "bytes", which may be negative, to the memory allocated
+    static void charge(const std::intmax_t bytes);
+
+  private:
+    static pthread::mutex              _mutex;
+    static pthread::condition_variable _released;        // notified when memory has been released
+    static std::uintmax_t              _reserved;        // protected by _mutex, including the memory set aside
+    static std::uintmax_t              _set_aside;       // protected by _mutex
+    static std::uintmax_t              _peak_reserved;   // protected by _mutex
+    static std::atomic<std::size_t>    _waiters;         // number of threads waiting for memory to be released
+    static std::atomic<std::intmax_t>  _allocated;
+    static std::atomic<std::intmax_t>  _peak_allocated;
+};
+
+// memory reserved for a file in flight, released on destruction
+class MemoryReservation {
+  public:
+    MemoryReservation();
+    ~MemoryReservation();
+
+    MemoryReservation(const MemoryReservation &) = delete;
+    MemoryReservation &operator=(const MemoryReservation &) = delete;
+
+    // reserves "bytes" more, waiting while the limit does not allow it, see MemoryBudget::reserve()
+    // Must not be called by a thread the files in flight depend on, since it might wait for them
+    void reserve(const std::uintmax_t bytes, const std::function<void()> &before_waiting = nullptr);
+    // reserves "bytes" more if the limit allows it without waiting, returns false otherwise
+    bool try_reserve(const std::uintmax_t bytes);
+    // sets the memory reserved to "bytes" without waiting, even if growing it exceeds the limit
+    // used for correcting the estimate reserved before once the file is known
+    void resize(const std::uintmax_t bytes);
+
+    // returns the memory reserved in bytes
+    std::uintmax_t size() const;
+
+  private:
+    std::uintmax_t _bytes;
+};
+
+// memory allocated by a buffer, charged to MemoryBudget and discharged on destruction
+// An instance must only be used by one thread at a time, like the buffer it belongs to
+class MemoryCharge {
+  public:
+    MemoryCharge();
+    ~MemoryCharge();
+
+    MemoryCharge(const MemoryCharge &) = delete;
+    MemoryCharge &operator=(const MemoryCharge &) = delete;
+
+    // sets the memory allocated by the buffer to "bytes"
+    void set(const std::size_t bytes);
+
+  private:
+    std::size_t _bytes;
+};
+
+#endif  // MEMORY_BUDGET_H
@@ -0,0 +1,64 @@
+#include "mp3_format.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+// bit rates of Layer III in kbit/s by bit rate index, 0 means "free format" which lame does not write
+static const uint32_t bit_rates_mpeg1[16] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0};
+static const uint32_t bit_rates_mpeg2[16] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0};
+// sampling rates in Hz by sampling rate index for MPEG 1, the rates of MPEG 2 are the half and of MPEG 2.5 the quarter
+static const uint32_t sampling_rates[4] = {44100, 48000, 32000, 0};
+
+size_t mp3_frame_size(const uint8_t *data, const size_t size) {
+    if (size < 4) {
+        return 0;
+    }
+    // the header starts with 11 bits set (frame sync), followed by 2 bits version and 2 bits layer
+    uint32_t header = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+    if ((header & 0xffe00000) != 0xffe00000) {
+        return 0;
+    }
+    uint32_t version             = header >> 19 & 3;  // 0: MPEG 2.5, 1: reserved, 2: MPEG 2, 3: MPEG 1
+    uint32_t layer               = header >> 17 & 3;  // 1: Layer III
+    uint32_t bit_rate_index      = header >> 12 & 15;
+    uint32_t sampling_rate_index = header >> 10 & 3;
+    uint32_t padding             = header >> 9 & 1;
+    if (version == 1 || layer != 1) {
+        return 0;
+    }
+    uint32_t bit_rate      = (version == 3 ? bit_rates_mpeg1 : bit_rates_mpeg2)[bit_rate_index] * 1000;
+    uint32_t sampling_rate = sampling_rates[sampling_rate_index] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+    if (bit_rate == 0 || sampling_rate == 0) {
+        return 0;
+    }
+    // a frame holds 1152 samples (MPEG 1) or 576 samples (MPEG 2 and 2.5), the padding adds a single byte
+    return (version == 3 ? 144 : 72) * bit_rate / sampling_rate + padding;
+}
+
+size_t id3v2_tag_size(const uint8_t *data, const size_t size) {
+    if (size < 10 || data[0] != 'I' || data[1] != 'D' || data[2] != '3') {
+        return 0;
+    }
+    // the size is stored in 4 bytes of 7 bits each ("synchsafe") and excludes the header and the footer
+    size_t tag_size = (size_t)(data[6] & 0x7f) << 21 | (size_t)(data[7] & 0x7f) << 14
+                      | (size_t)(data[8] & 0x7f) << 7 | (size_t)(data[9] & 0x7f);
+    bool has_footer = data[5] & 0x10;
+    return 10 + tag_size + (has_footer ? 10 : 0);
+}
+
+size_t skip_mp3_frames(const uint8_t *data, const size_t size, size_t offset, const size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        size_t frame_size = offset < size ? mp3_frame_size(data + offset, size - offset) : 0;
+        if (frame_size == 0 || frame_size > size - offset) {
+            ostringstream err;
+            err << "unexpected error: no complete MP3 frame at offset " << offset << " of the encoded data";
+            throw runtime_error(err.str());
+        }
+        offset += frame_size;
+    }
+    return offset;
+}
@@ -0,0 +1,24 @@
+#ifndef MP3_FORMAT_H
+#define MP3_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+// MP3 frame header reference used:
+// "http://www.mp3-tech.org/programmer/frame_header.html"
+// ID3v2 header reference used:
+// "https://id3.org/id3v2.4.0-structure"
+
+// returns the size in bytes of the MPEG 1, 2 or 2.5 Layer III frame starting at "data" including its header
+// or 0 if the "size" bytes at "data" do not start with a valid frame header
+std::size_t mp3_frame_size(const std::uint8_t *data, const std::size_t size);
+
+// returns the size in bytes of the ID3v2 tag (including header and footer) at the beginning of "data"
+// or 0 if the "size" bytes at "data" do not start with an ID3v2 tag
+std::size_t id3v2_tag_size(const std::uint8_t *data, const std::size_t size);
+
+// returns the offset following the "count" MP3 frames starting at offset "offset" of "data"
+// throws a runtime_error if one of the frames is invalid or incomplete
+std::size_t skip_mp3_frames(const std::uint8_t *data, const std::size_t size, std::size_t offset,
+                            const std::size_t count);
+
+#endif  // MP3_FORMAT_H
@@ -0,0 +1,403 @@
+#include "output_file.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// size of the buffer BufferedOutputFile collects the data in and its alignment,
+// which is the page size of all common processors
+static const size_t output_buffer_size      = 1024 * 1024;
+static const size_t output_buffer_alignment = 4096;
+
+// size and number of the blocks UringOutputFile collects the data in
+static const size_t write_block_size  = 256 * 1024;
+static const size_t write_block_depth = 4;
+
+// size of the buffer of an std::ofstream, BUFSIZ of the common standard libraries
+static const size_t stream_buffer_size = 8192;
+
+OutputFile::~OutputFile() {
+}
+
+shared_ptr<OutputFile> OutputFile::create(const fs::path &filename, const OutputBackend backend) {
+    switch (backend) {
+        case OutputBackend::io_uring: {
+            shared_ptr<UringOutputFile> file(new UringOutputFile());
+            if (file->create(filename)) {
+                return file;
+            }
+            // if setting up io_uring failed, e.g. due to resource limits, fall back to buffered output
+        }
+            [[fallthrough]];
+        case OutputBackend::buffered: {
+            shared_ptr<BufferedOutputFile> file(new BufferedOutputFile());
+            if (file->create(filename)) {
+                return file;
+            }
+            // not available under Windows, fall back to ofstream
+        }
+            [[fallthrough]];
+        case OutputBackend::ofstream:
+        default: {
+            shared_ptr<StreamOutputFile> file(new StreamOutputFile());
+            return file->create(filename) ? file : nullptr;
+        }
+    }
+}
+
+uintmax_t OutputFile::memory_needed(const OutputBackend backend) {
+    switch (backend) {
+        case OutputBackend::io_uring:
+            return write_block_size * write_block_depth;
+        case OutputBackend::buffered:
+            return output_buffer_size;
+        case OutputBackend::ofstream:
+        default:
+            return stream_buffer_size;
+    }
+}
+
+void OutputFile::preallocate(const uintmax_t /* size */) {
+}
+
+#if !defined(_WIN32)
+// helper functions for BufferedOutputFile and UringOutputFile
+
+// allocates "size" bytes for the file "fd", returns true if the file system supports it
+// Only fallocate() of Linux is used since posix_fallocate() falls back to writing zeros. FALLOC_FL_KEEP_SIZE
+// allocates the blocks beyond the end of the file without changing its size, so the file never appears with the
+// estimated size and trailing zeros, even if the conversion is aborted before close() truncates it
+static bool preallocate_file(const int fd, const uintmax_t size) {
+#if defined(__linux__)
+    return fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size) == 0;
+#else
+    (void)fd;
+    (void)size;
+    return false;
+#endif
+}
+
+// writes all "size" bytes of "data" to the file "fd" at file offset "offset" even if pwrite() writes less
+// returns 0 on success and errno on failure
+static int write_all(const int fd, const byte *data, const size_t size, const uintmax_t offset) {
+    size_t written = 0;
+    while (written < size) {
+        ssize_t ret = pwrite(fd, data + written, size - written, (off_t)(offset + written));
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return ret < 0 ? errno : EIO;
+        }
+        written += (size_t)ret;
+    }
+    return 0;
+}
+#endif  // _WIN32
+
+bool StreamOutputFile::create(const fs::path &filename) {
+    _stream.open(filename, ios::binary | ios::trunc | ios::out);
+    return !_stream.fail();
+}
+
+void StreamOutputFile::write(const void *data, const size_t size) {
+    _stream.write((const char *)data, size);
+    if (_stream.fail()) {
+        throw runtime_error("writing MP3 data failed");
+    }
+}
+
+bool StreamOutputFile::close() {
+    if (!_stream.is_open()) {
+        return true;
+    }
+    _stream.close();
+    return !_stream.fail();
+}
+
+BufferedOutputFile::BufferedOutputFile()
+    : _fd(-1)
+    , _buffer(nullptr)
+    , _used(0)
+    , _position(0)
+    , _preallocated(false) {
+}
+
+#if !defined(_WIN32)
+
+BufferedOutputFile::~BufferedOutputFile() {
+    close();
+    ::operator delete(_buffer, align_val_t(output_buffer_alignment));
+}
+
+bool BufferedOutputFile::create(const fs::path &filename) {
+    _fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (_fd < 0) {
+        return false;
+    }
+    _buffer = (byte *)::operator new(output_buffer_size, align_val_t(output_buffer_alignment));
+    _buffer_charge.set(output_buffer_size);
+    return true;
+}
+
+void BufferedOutputFile::preallocate(const uintmax_t size) {
+    if (_fd >= 0 && _position == 0 && _used == 0) {
+        _preallocated = preallocate_file(_fd, size);
+    }
+}
+
+void BufferedOutputFile::write(const void *data, const size_t size) {
+    if (_used + size > output_buffer_size && !flush()) {
+        throw runtime_error(string("writing MP3 data failed: ") + strerror(errno));
+    }
+    // data which does not fit into the buffer at all is written directly
+    if (size > output_buffer_size) {
+        int error = write_all(_fd, (const byte *)data, size, _position);
+        if (error) {
+            throw runtime_error(string("writing MP3 data failed: ") + strerror(error));
+        }
+        _position += size;
+        return;
+    }
+    memcpy(_buffer + _used, data, size);
+    _used += size;
+}
+
+bool BufferedOutputFile::flush() {
+    int error = write_all(_fd, _buffer, _used, _position);
+    if (error) {
+        errno = error;
+        return false;
+    }
+    _position += _used;
+    _used = 0;
+    return true;
+}
+
+bool BufferedOutputFile::close() {
+    if (_fd < 0) {
+        return true;
+    }
+    bool was_successful = flush();
+    // release the preallocated blocks beyond the end of the data, which the estimate may exceed
+    if (_preallocated) {
+        was_successful = ftruncate(_fd, (off_t)_position) == 0 && was_successful;
+    }
+    was_successful = ::close(_fd) == 0 && was_successful;
+    _fd            = -1;
+    return was_successful;
+}
+
+#else  // _WIN32
+
+BufferedOutputFile::~BufferedOutputFile() {
+}
+
+bool BufferedOutputFile::create(const fs::path & /* filename */) {
+    return false;
+}
+
+void BufferedOutputFile::preallocate(const uintmax_t /* size */) {
+}
+
+void BufferedOutputFile::write(const void * /* data */, const size_t /* size */) {
+    throw runtime_error("buffered output not supported");
+}
+
+bool BufferedOutputFile::flush() {
+    return false;
+}
+
+bool BufferedOutputFile::close() {
+    return true;
+}
+
+#endif  // _WIN32
+
+UringOutputFile::UringOutputFile()
+    : _fd(-1)
+    , _ring(nullptr)
+    , _blocks(write_block_depth)
+    , _current_block(0)
+    , _position(0)
+    , _preallocated(false) {
+}
+
+#ifdef WAV2MP3_HAS_IO_URING
+
+UringOutputFile::~UringOutputFile() {
+    // the kernel may still read from the buffers of blocks in flight, so they are kept until it is done with them
+    // usually close() has already waited for them
+    for (auto &block : _blocks) {
+        if (block.request.in_flight) {
+            _ring->retire(block.request, block.buffer);
+        }
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+}
+
+bool UringOutputFile::create(const fs::path &filename) {
+    // check io_uring first, so that the file is not created if falling back to BufferedOutputFile
+    if (!IoUring::is_supported()) {
+        return false;
+    }
+    _fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (_fd < 0) {
+        return false;
+    }
+    for (auto &block : _blocks) {
+        block.buffer.resize(write_block_size);
+        block.charge.set(block.buffer.capacity());
+    }
+    return true;
+}
+
+void UringOutputFile::write(const void *data, const size_t size) {
+    const byte *source    = (const byte *)data;
+    size_t      remaining = size;
+    while (remaining > 0) {
+        WriteBlock &block = _blocks[_current_block];
+        size_t      count = write_block_size - block.used < remaining ? write_block_size - block.used : remaining;
+        memcpy(block.buffer.data() + block.used, source, count);
+        block.used += count;
+        source += count;
+        remaining -= count;
+        if (block.used == write_block_size) {
+            // continue collecting in the next block as soon as it has been written
+            _current_block = (_current_block + 1) % _blocks.size();
+            if (!submit(block) || !wait_for(_blocks[_current_block])) {
+                throw runtime_error("writing MP3 data failed: " + _error);
+            }
+        }
+    }
+}
+
+bool UringOutputFile::close() {
+    if (_fd < 0) {
+        return true;
+    }
+    bool was_successful = _error.empty() && submit(_blocks[_current_block]);
+    for (auto &block : _blocks) {
+        was_successful = wait_for(block) && was_successful;
+        // the blocks which could not be waited for are passed to the ring, which is only possible in this thread
+        if (block.request.in_flight) {
+            _ring->retire(block.request, block.buffer);
+        }
+    }
+    // release the preallocated blocks beyond the end of the data, which the estimate may exceed
+    if (_preallocated) {
+        was_successful = ftruncate(_fd, (off_t)_position) == 0 && was_successful;
+    }
+    was_successful = ::close(_fd) == 0 && was_successful;
+    _fd            = -1;
+    return was_successful;
+}
+
+void UringOutputFile::preallocate(const uintmax_t size) {
+    if (_fd >= 0 && _position == 0 && _blocks[_current_block].used == 0) {
+        _preallocated = preallocate_file(_fd, size);
+    }
+}
+
+bool UringOutputFile::submit(WriteBlock &block) {
+    if (block.used == 0) {
+        return true;
+    }
+    block.start = _position;
+    _position += block.used;
+    if (!_ring) {
+        _ring = &IoUring::of_current_thread();
+    }
+    if (!_ring->prepare_write(_fd, block.buffer.data(), (uint32_t)block.used, block.start, block.request)) {
+        // without io_uring the block is written right away
+        int error = write_all(_fd, block.buffer.data(), block.used, block.start);
+        if (error) {
+            _error = strerror(error);
+        }
+        block.used = 0;
+        return _error.empty();
+    }
+    // the request is queued even if submitting fails, so it has to be waited for before the buffer is released
+    block.submitted = true;
+    if (!_ring->submit()) {
+        _error = "submitting write request failed";
+        return false;
+    }
+    return true;
+}
+
+bool UringOutputFile::wait_for(WriteBlock &block) {
+    if (!block.submitted) {
+        return _error.empty();  // the block has not been submitted at all
+    }
+    if (!_ring->wait_for(block.request)) {
+        _error = "waiting for write request failed";
+        return false;
+    }
+    block.submitted = false;
+    int32_t result  = block.request.result;
+    size_t  written = result < 0 ? 0 : (size_t)result;
+    if (result < 0) {
+        _error = strerror(-result);
+    }
+    // write requests may complete with less bytes than requested, in that case write the rest synchronously
+    if (_error.empty() && written < block.used) {
+        int error = write_all(_fd, block.buffer.data() + written, block.used - written, block.start + written);
+        if (error) {
+            _error = strerror(error);
+        }
+    }
+    block.used = 0;
+    return _error.empty();
+}
+
+#else  // WAV2MP3_HAS_IO_URING
+
+UringOutputFile::~UringOutputFile() {
+}
+
+bool UringOutputFile::create(const fs::path & /* filename */) {
+    return false;
+}
+
+void UringOutputFile::write(const void * /* data */, const size_t /* size */) {
+    throw runtime_error("io_uring not supported");
+}
+
+bool UringOutputFile::close() {
+    return true;
+}
+
+void UringOutputFile::preallocate(const uintmax_t /* size */) {
+}
+
+#endif  // WAV2MP3_HAS_IO_URING
+
+void MemoryOutputFile::write(const void *data, const size_t size) {
+    _data.insert(_data.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+    _data_charge.set(_data.capacity());
+}
+
+bool MemoryOutputFile::close() {
+    return true;
+}
+
+const vector<uint8_t> &MemoryOutputFile::data() const {
+    return _data;
+}
@@ -0,0 +1,154 @@
+//
+// declares class OutputFile used for writing the encoded MP3 data
+// Three implementations are available, selected by Configuration::output_backend():
+//     - StreamOutputFile: writes using an std::ofstream
+//     - BufferedOutputFile: collects the data in a large buffer written with few big write calls
+//       (not available under Windows, falls back to StreamOutputFile)
+//     - UringOutputFile: collects the data in blocks which are written asynchronously using io_uring
+//       (Linux only, falls back to BufferedOutputFile if io_uring is not available)
+// BufferedOutputFile and UringOutputFile support preallocating the file under Linux
+// MemoryOutputFile collects the data in memory only, used for the segments of a file encoded in parallel
+//
+
+#ifndef OUTPUT_FILE_H
+#define OUTPUT_FILE_H
+
+#include "configuration.h"
+#include "io_uring.h"
+#include "memory_budget.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>  // forward declarations could be used here but they can be very error prone, see:
+                       // https://google.github.io/styleguide/cppguide.html#Forward_Declarations
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+class OutputFile {
+  public:
+    virtual ~OutputFile();
+
+    // creates an OutputFile instance of the implementation matching the passed backend
+    // and creates the file "filename" for writing. An already existing file is truncated
+    // returns nullptr if creating the file fails
+    static std::shared_ptr<OutputFile> create(const std::filesystem::path &filename, const OutputBackend backend);
+
+    // returns the memory the buffers of an OutputFile of "backend" need at most, see MemoryBudget
+    static std::uintmax_t memory_needed(const OutputBackend backend);
+
+    // appends "size" bytes starting at "data" to the file
+    // throws a runtime_error on failure
+    virtual void write(const void *data, const std::size_t size) = 0;
+
+    // writes all pending data and closes the file. If the file has been preallocated
+    // it is truncated to the size of the data written
+    // returns false on failure. Calling close() on a file already closed just returns true
+    virtual bool close() = 0;
+
+    // hint that about "size" bytes are going to be written, so that the file system can allocate them
+    // at once reducing the fragmentation of the file. Must be called before the first write()
+    virtual void preallocate(const std::uintmax_t size);
+};
+
+// OutputFile implementation writing using an std::ofstream
+class StreamOutputFile : public OutputFile {
+  public:
+    // creates the file "filename", returns false on failure
+    bool create(const std::filesystem::path &filename);
+
+    void write(const void *data, const std::size_t size) override;
+    bool close() override;
+
+  private:
+    std::ofstream _stream;
+};
+
+// OutputFile implementation collecting the data in a large buffer which is written with a single write call
+// as soon as it is full
+class BufferedOutputFile : public OutputFile {
+  public:
+    BufferedOutputFile();
+    ~BufferedOutputFile() override;
+
+    BufferedOutputFile(const BufferedOutputFile &) = delete;
+    BufferedOutputFile &operator=(const BufferedOutputFile &) = delete;
+
+    // creates the file "filename", returns false on failure
+    bool create(const std::filesystem::path &filename);
+
+    void write(const void *data, const std::size_t size) override;
+    bool close() override;
+    void preallocate(const std::uintmax_t size) override;
+
+  private:
+    bool flush();
+
+  private:
+    int            _fd;
+    std::byte *    _buffer;
+    MemoryCharge   _buffer_charge;
+    std::size_t    _used;          // number of bytes collected in _buffer
+    std::uintmax_t _position;      // number of bytes written to the file
+    bool           _preallocated;  // the file has to be truncated on closing
+};
+
+// OutputFile implementation writing asynchronously using io_uring
+// The data passed to write() is collected in a block. Only a full block is submitted for writing and collecting
+// continues in the next block, so that write() has to wait only if all blocks are still being written
+// The blocks are submitted to the io_uring of the thread calling write(), so the file must be written and closed by
+// one thread only. If that thread has no io_uring, e.g. due to resource limits, the blocks are written synchronously
+class UringOutputFile : public OutputFile {
+  public:
+    UringOutputFile();
+    ~UringOutputFile() override;
+
+    UringOutputFile(const UringOutputFile &) = delete;
+    UringOutputFile &operator=(const UringOutputFile &) = delete;
+
+    // creates the file "filename", returns false on failure or if the kernel does not support io_uring
+    bool create(const std::filesystem::path &filename);
+
+    void write(const void *data, const std::size_t size) override;
+    bool close() override;
+    void preallocate(const std::uintmax_t size) override;
+
+  private:
+    typedef struct WriteBlock {
+        std::vector<std::byte> buffer;
+        MemoryCharge           charge;
+        std::size_t            used      = 0;      // number of bytes collected in buffer
+        std::uintmax_t         start     = 0;      // file offset the block is written to
+        bool                   submitted = false;  // the write request was submitted but its result is not checked yet
+        IoRequest              request;
+    } WriteBlock;
+
+    bool submit(WriteBlock &block);
+    bool wait_for(WriteBlock &block);
+
+  private:
+    int                     _fd;
+    IoUring *               _ring;  // io_uring of the thread writing, nullptr until the first block is submitted
+    std::vector<WriteBlock> _blocks;
+    std::size_t             _current_block;  // index of the block currently collecting the data
+    std::uintmax_t          _position;       // file offset of the first byte of the current block
+    std::string             _error;          // describes the first failure of a write request
+    bool                    _preallocated;   // the file has to be truncated on closing
+};
+
+// OutputFile implementation collecting the data in memory without writing any file
+class MemoryOutputFile : public OutputFile {
+  public:
+    void write(const void *data, const std::size_t size) override;
+    bool close() override;
+
+    // the data written so far
+    const std::vector<std::uint8_t> &data() const;
+
+  private:
+    std::vector<std::uint8_t> _data;
+    MemoryCharge              _data_charge;
+};
+
+#endif  // OUTPUT_FILE_H
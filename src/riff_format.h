@@ -19,6 +19,26 @@ extern std::map<uint16_t, std::string> audio_format_uint16_to_names;
 extern std::map<Guid, std::string> audio_format_guid_to_names;
 // extern std::map<std::string, Guid> audio_format_names_to_guid;
 
+// FOURCC chunk ids as 32 bit integers with the first character in the lowest byte
+// fourcc() is constexpr so that ids like fourcc("fmt ") are compile-time constants
+// and chunk ids can be compared without building strings
+constexpr std::uint32_t fourcc(const char (&id)[5]) {
+    return (std::uint32_t)(std::uint8_t)id[0] | (std::uint32_t)(std::uint8_t)id[1] << 8
+           | (std::uint32_t)(std::uint8_t)id[2] << 16 | (std::uint32_t)(std::uint8_t)id[3] << 24;
+}
+
+// returns the FOURCC chunk id stored in the 4 bytes starting at raw
+inline std::uint32_t read_fourcc(const void *raw) {
+    const std::uint8_t *bytes = (const std::uint8_t *)raw;
+    return (std::uint32_t)bytes[0] | (std::uint32_t)bytes[1] << 8 | (std::uint32_t)bytes[2] << 16
+           | (std::uint32_t)bytes[3] << 24;
+}
+
+// returns the FOURCC chunk id as string of 4 characters, e.g. for messages
+inline std::string fourcc_to_string(const std::uint32_t id) {
+    return std::string{(char)(id & 0xff), (char)(id >> 8 & 0xff), (char)(id >> 16 & 0xff), (char)(id >> 24)};
+}
+
 // RIFF header
 
 typedef struct RiffHeader {
@@ -0,0 +1,310 @@
+//
+// implements the sample conversion functions declared in sample_conversion.h
+// Design decisions:
+//     - for every sample container size there is one kernel per instruction set.
+//       The kernels process as many samples as possible with SIMD instructions and
+//       leave the remaining few samples at the end of the block to the scalar fallback
+//     - the best instruction set supported by the processor is determined only once per process
+//       via CPUID. Then the function pointers of the matching kernels are stored in a static SampleKernels
+//       instance, so that no further checks are necessary when converting a block
+//     - the kernels are compiled using function specific target attributes instead of global compiler switches
+//       so that the executable still runs on processors not supporting e.g. AVX2
+
+#include "sample_conversion.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SAMPLE_CONVERSION_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC allows using all intrinsics without enabling them first,
+// GCC and clang require them to be enabled for the function using them
+#if defined(_MSC_VER)
+#define TARGET_ISA(isa)
+#else
+#define TARGET_ISA(isa) __attribute__((target(isa)))
+#endif
+
+using namespace std;
+
+typedef void (*UnpackKernel)(const char *raw, int32_t *samples, const uint32_t number_of_samples,
+                             const uint32_t shift);
+
+// function pointers to the kernels used for the instruction set supported by the processor
+typedef struct SampleKernels {
+    const char * instruction_set;
+    UnpackKernel unpack[5];  // indexed by the number of bytes per sample, index 0 is unused
+} SampleKernels;
+
+// scalar fallback: reference implementation for all SIMD kernels and
+// also used by them for the samples at the end of a block not filling a whole SIMD register
+static void unpack_scalar(const char *raw, int32_t *samples, const uint32_t number_of_samples,
+                          const uint32_t bytes_per_sample, const uint32_t shift) {
+    for (uint32_t i = 0; i < number_of_samples; i++, raw += bytes_per_sample) {
+        int32_t c = 0;
+        memcpy(&c, raw, bytes_per_sample);
+        if (bytes_per_sample == 1) {
+            c -= 128;
+        }
+        samples[i] = (int32_t)((uint32_t)c << shift);  // expands values to the full range of int32_t
+    }
+}
+
+template <uint32_t bytes_per_sample>
+static void unpack_scalar(const char *raw, int32_t *samples, const uint32_t number_of_samples, const uint32_t shift) {
+    unpack_scalar(raw, samples, number_of_samples, bytes_per_sample, shift);
+}
+
+#if defined(SAMPLE_CONVERSION_X86)
+
+// SSE2 kernels
+// SSE2 has no byte shuffle instruction, so 24 bit samples are unpacked by the scalar fallback
+
+TARGET_ISA("sse2")
+static void unpack_8_sse2(const char *raw, int32_t *samples, const uint32_t number_of_samples, const uint32_t shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i bias  = _mm_set1_epi32(128);
+    uint32_t      i     = 0;
+    for (; i + 16 <= number_of_samples; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(raw + i));
+        __m128i lo    = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi    = _mm_unpackhi_epi8(bytes, zero);
+        __m128i *out  = (__m128i *)(samples + i);
+        _mm_storeu_si128(out + 0, _mm_sll_epi32(_mm_sub_epi32(_mm_unpacklo_epi16(lo, zero), bias), count));
+        _mm_storeu_si128(out + 1, _mm_sll_epi32(_mm_sub_epi32(_mm_unpackhi_epi16(lo, zero), bias), count));
+        _mm_storeu_si128(out + 2, _mm_sll_epi32(_mm_sub_epi32(_mm_unpacklo_epi16(hi, zero), bias), count));
+        _mm_storeu_si128(out + 3, _mm_sll_epi32(_mm_sub_epi32(_mm_unpackhi_epi16(hi, zero), bias), count));
+    }
+    unpack_scalar(raw + i, samples + i, number_of_samples - i, 1, shift);
+}
+
+TARGET_ISA("sse2")
+static void unpack_16_sse2(const char *raw, int32_t *samples, const uint32_t number_of_samples, const uint32_t shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m128i zero  = _mm_setzero_si128();
+    uint32_t      i     = 0;
+    for (; i + 8 <= number_of_samples; i += 8) {
+        __m128i  words = _mm_loadu_si128((const __m128i *)(raw + 2 * i));
+        __m128i *out   = (__m128i *)(samples + i);
+        _mm_storeu_si128(out + 0, _mm_sll_epi32(_mm_unpacklo_epi16(words, zero), count));
+        _mm_storeu_si128(out + 1, _mm_sll_epi32(_mm_unpackhi_epi16(words, zero), count));
+    }
+    unpack_scalar(raw + 2 * i, samples + i, number_of_samples - i, 2, shift);
+}
+
+TARGET_ISA("sse2")
+static void unpack_32_sse2(const char *raw, int32_t *samples, const uint32_t number_of_samples, const uint32_t shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    uint32_t      i     = 0;
+    for (; i + 4 <= number_of_samples; i += 4) {
+        __m128i dwords = _mm_loadu_si128((const __m128i *)(raw + 4 * i));
+        _mm_storeu_si128((__m128i *)(samples + i), _mm_sll_epi32(dwords, count));
+    }
+    unpack_scalar(raw + 4 * i, samples + i, number_of_samples - i, 4, shift);
+}
+
+// AVX2 kernels
+
+TARGET_ISA("avx2")
+static void unpack_8_avx2(const char *raw, int32_t *samples, const uint32_t number_of_samples, const uint32_t shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m256i bias  = _mm256_set1_epi32(128);
+    uint32_t      i     = 0;
+    for (; i + 8 <= number_of_samples; i += 8) {
+        __m256i dwords = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(raw + i)));
+        _mm256_storeu_si256((__m256i *)(samples + i), _mm256_sll_epi32(_mm256_sub_epi32(dwords, bias), count));
+    }
+    unpack_scalar(raw + i, samples + i, number_of_samples - i, 1, shift);
+}
+
+TARGET_ISA("avx2")
+static void unpack_16_avx2(const char *raw, int32_t *samples, const uint32_t number_of_samples, const uint32_t shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    uint32_t      i     = 0;
+    for (; i + 8 <= number_of_samples; i += 8) {
+        __m256i dwords = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(raw + 2 * i)));
+        _mm256_storeu_si256((__m256i *)(samples + i), _mm256_sll_epi32(dwords, count));
+    }
+    unpack_scalar(raw + 2 * i, samples + i, number_of_samples - i, 2, shift);
+}
+
+TARGET_ISA("avx2")
+static void unpack_24_avx2(const char *raw, int32_t *samples, const uint32_t number_of_samples, const uint32_t shift) {
+    // the byte shuffle moves the three bytes of each sample into the upper three bytes of a 32 bit lane,
+    // which already shifts them left by 8 bits
+    const __m128i count = _mm_cvtsi32_si128(shift - 8);
+    // distributes the bytes 0-15 to the lower and the bytes 12-27 to the upper 128 bit lane,
+    // since the byte shuffle cannot cross lanes
+    const __m256i permutation = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    const __m256i shuffle = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,  // lower lane
+                                             -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);  // upper lane
+    uint32_t i = 0;
+    // 32 bytes are loaded to convert 8 samples occupying 24 bytes, so make sure not to read beyond the block
+    for (; i + 11 <= number_of_samples; i += 8) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(raw + 3 * i));
+        bytes         = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(bytes, permutation), shuffle);
+        _mm256_storeu_si256((__m256i *)(samples + i), _mm256_sll_epi32(bytes, count));
+    }
+    unpack_scalar(raw + 3 * i, samples + i, number_of_samples - i, 3, shift);
+}
+
+TARGET_ISA("avx2")
+static void unpack_32_avx2(const char *raw, int32_t *samples, const uint32_t number_of_samples, const uint32_t shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    uint32_t      i     = 0;
+    for (; i + 8 <= number_of_samples; i += 8) {
+        __m256i dwords = _mm256_loadu_si256((const __m256i *)(raw + 4 * i));
+        _mm256_storeu_si256((__m256i *)(samples + i), _mm256_sll_epi32(dwords, count));
+    }
+    unpack_scalar(raw + 4 * i, samples + i, number_of_samples - i, 4, shift);
+}
+
+// AVX-512 kernels (require the foundation and the byte/word extensions)
+
+TARGET_ISA("avx512f,avx512bw")
+static void unpack_8_avx512(const char *raw, int32_t *samples, const uint32_t number_of_samples, const uint32_t shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m512i bias  = _mm512_set1_epi32(128);
+    uint32_t      i     = 0;
+    for (; i + 16 <= number_of_samples; i += 16) {
+        __m512i dwords = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(raw + i)));
+        _mm512_storeu_si512(samples + i, _mm512_sll_epi32(_mm512_sub_epi32(dwords, bias), count));
+    }
+    unpack_scalar(raw + i, samples + i, number_of_samples - i, 1, shift);
+}
+
+TARGET_ISA("avx512f,avx512bw")
+static void unpack_16_avx512(const char *raw, int32_t *samples, const uint32_t number_of_samples,
+                             const uint32_t shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    uint32_t      i     = 0;
+    for (; i + 16 <= number_of_samples; i += 16) {
+        __m512i dwords = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(raw + 2 * i)));
+        _mm512_storeu_si512(samples + i, _mm512_sll_epi32(dwords, count));
+    }
+    unpack_scalar(raw + 2 * i, samples + i, number_of_samples - i, 2, shift);
+}
+
+TARGET_ISA("avx512f,avx512bw")
+static void unpack_24_avx512(const char *raw, int32_t *samples, const uint32_t number_of_samples,
+                             const uint32_t shift) {
+    // same approach as unpack_24_avx2() but with four 128 bit lanes, each receiving the bytes of four samples
+    const __m128i count       = _mm_cvtsi32_si128(shift - 8);
+    const __m512i permutation = _mm512_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6, 6, 7, 8, 9, 9, 10, 11, 12);
+    const __m512i shuffle =
+        _mm512_broadcast_i32x4(_mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11));
+    uint32_t i = 0;
+    // 64 bytes are loaded to convert 16 samples occupying 48 bytes, so make sure not to read beyond the block
+    for (; i + 22 <= number_of_samples; i += 16) {
+        __m512i bytes = _mm512_loadu_si512(raw + 3 * i);
+        bytes         = _mm512_shuffle_epi8(_mm512_permutexvar_epi32(permutation, bytes), shuffle);
+        _mm512_storeu_si512(samples + i, _mm512_sll_epi32(bytes, count));
+    }
+    unpack_scalar(raw + 3 * i, samples + i, number_of_samples - i, 3, shift);
+}
+
+TARGET_ISA("avx512f,avx512bw")
+static void unpack_32_avx512(const char *raw, int32_t *samples, const uint32_t number_of_samples,
+                             const uint32_t shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    uint32_t      i     = 0;
+    for (; i + 16 <= number_of_samples; i += 16) {
+        __m512i dwords = _mm512_loadu_si512(raw + 4 * i);
+        _mm512_storeu_si512(samples + i, _mm512_sll_epi32(dwords, count));
+    }
+    unpack_scalar(raw + 4 * i, samples + i, number_of_samples - i, 4, shift);
+}
+
+#endif  // SAMPLE_CONVERSION_X86
+
+static const SampleKernels scalar_kernels = {
+    "scalar", {nullptr, unpack_scalar<1>, unpack_scalar<2>, unpack_scalar<3>, unpack_scalar<4>}};
+
+#if defined(SAMPLE_CONVERSION_X86)
+static const SampleKernels sse2_kernels = {
+    "SSE2", {nullptr, unpack_8_sse2, unpack_16_sse2, unpack_scalar<3>, unpack_32_sse2}};
+
+static const SampleKernels avx2_kernels = {
+    "AVX2", {nullptr, unpack_8_avx2, unpack_16_avx2, unpack_24_avx2, unpack_32_avx2}};
+
+static const SampleKernels avx512_kernels = {
+    "AVX-512", {nullptr, unpack_8_avx512, unpack_16_avx512, unpack_24_avx512, unpack_32_avx512}};
+#endif
+
+// queries the processor via CPUID for the supported instruction sets
+// and returns the kernels of all of them, the best first and the scalar ones last
+static vector<const SampleKernels *> supported_kernels() {
+    vector<const SampleKernels *> supported;
+#if defined(SAMPLE_CONVERSION_X86)
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+    __cpuid(info, 1);
+    const bool sse2    = (info[3] & (1 << 26)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool       avx2    = false;
+    bool       avx512  = false;
+    if (osxsave && max_leaf >= 7) {
+        // the operating system must save the YMM (and ZMM) registers on context switches
+        unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        avx2   = (info[1] & (1 << 5)) && ((xcr0 & 0x06) == 0x06);
+        avx512 = (info[1] & (1 << 16)) && (info[1] & (1 << 30)) && ((xcr0 & 0xe6) == 0xe6);
+    }
+#else
+    __builtin_cpu_init();
+    const bool sse2   = __builtin_cpu_supports("sse2");
+    const bool avx2   = __builtin_cpu_supports("avx2");
+    const bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    if (avx512) {
+        supported.push_back(&avx512_kernels);
+    }
+    if (avx2) {
+        supported.push_back(&avx2_kernels);
+    }
+    if (sse2) {
+        supported.push_back(&sse2_kernels);
+    }
+#endif
+    supported.push_back(&scalar_kernels);
+    return supported;
+}
+
+// the kernels are selected once on first use. The initialization of a static local variable is thread safe
+static const SampleKernels &kernels() {
+    static const SampleKernels &selected_kernels = *supported_kernels().front();
+    return selected_kernels;
+}
+
+void unpack_pcm_int_samples(const char *raw, int32_t *samples, const uint32_t number_of_samples,
+                            const uint32_t bytes_per_sample, const uint32_t valid_bits_per_sample) {
+    kernels().unpack[bytes_per_sample](raw, samples, number_of_samples,
+                                       (uint32_t)(sizeof(int32_t) * 8) - valid_bits_per_sample);
+}
+
+const char *sample_conversion_instruction_set() {
+    return kernels().instruction_set;
+}
+
+bool unpack_pcm_int_samples_using(const char *instruction_set, const char *raw, int32_t *samples,
+                                  const uint32_t number_of_samples, const uint32_t bytes_per_sample,
+                                  const uint32_t valid_bits_per_sample) {
+    for (const SampleKernels *supported : supported_kernels()) {
+        if (strcmp(supported->instruction_set, instruction_set) == 0) {
+            supported->unpack[bytes_per_sample](raw, samples, number_of_samples,
+                                                (uint32_t)(sizeof(int32_t) * 8) - valid_bits_per_sample);
+            return true;
+        }
+    }
+    return false;
+}
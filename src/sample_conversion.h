@@ -0,0 +1,37 @@
+//
+// exports functions converting blocks of raw integer PCM samples into the sample format expected by the lame encoder
+// functions. On x86 processors SIMD kernels are used (SSE2, AVX2 or AVX-512), the best one supported by the
+// processor is selected once per process. All kernels yield bit-exactly the same result as the scalar fallback.
+//
+
+#ifndef SAMPLE_CONVERSION_H
+#define SAMPLE_CONVERSION_H
+
+#include <cstdint>
+
+/*!
+ * Unpacks number_of_samples little endian integer PCM samples stored in containers of bytes_per_sample (1...4) bytes
+ * starting at raw into samples. Every sample is left-justified, meaning it is shifted by
+ * 32 - valid_bits_per_sample bits to the left to expand it to the full range of int32_t
+ * as expected by lame_encode_buffer_int() and lame_encode_buffer_interleaved_int()
+ * 8 bit samples are unsigned, so their bias of 128 is removed before.
+ */
+void unpack_pcm_int_samples(const char *raw, std::int32_t *samples, const std::uint32_t number_of_samples,
+                            const std::uint32_t bytes_per_sample, const std::uint32_t valid_bits_per_sample);
+
+/*!
+ * returns the name of the instruction set used by the conversion functions above,
+ * one of "AVX-512", "AVX2", "SSE2" or "scalar"
+ */
+const char *sample_conversion_instruction_set();
+
+/*!
+ * same as unpack_pcm_int_samples() but using the kernels of "instruction_set" instead of the best ones, for
+ * checking the kernels against each other. "instruction_set" is one of the names returned by
+ * sample_conversion_instruction_set(). Returns false if the processor does not support it
+ */
+bool unpack_pcm_int_samples_using(const char *instruction_set, const char *raw, std::int32_t *samples,
+                                  const std::uint32_t number_of_samples, const std::uint32_t bytes_per_sample,
+                                  const std::uint32_t valid_bits_per_sample);
+
+#endif  // SAMPLE_CONVERSION_H
@@ -0,0 +1,148 @@
+#include "schedule.h"
+#include "signal_handler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+Schedule::Schedule(const SchedulePolicy policy)
+    : _policy(policy)
+    , _makespan(0.0) {
+}
+
+size_t Schedule::add(const fs::path &path) {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    _files.push_back({path});
+    return _files.size() - 1;
+}
+
+void Schedule::set_cost(const size_t index, const uintmax_t cost) {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    _files[index].cost = cost;
+}
+
+vector<size_t> Schedule::order() const {
+    vector<size_t> order(_files.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    // the sorts are stable, so files of equal cost stay in the order they have been found
+    switch (_policy) {
+        case SchedulePolicy::longest_first:
+            stable_sort(order.begin(), order.end(),
+                        [this](const size_t a, const size_t b) { return _files[a].cost > _files[b].cost; });
+            break;
+        case SchedulePolicy::shortest_first:
+            stable_sort(order.begin(), order.end(),
+                        [this](const size_t a, const size_t b) { return _files[a].cost < _files[b].cost; });
+            break;
+        case SchedulePolicy::directory: {
+            // the directories are taken in the order their first file has been found
+            unordered_map<string, size_t> first_found;
+            vector<size_t>                group(_files.size());
+            for (size_t i = 0; i < _files.size(); ++i) {
+                group[i] = first_found.emplace(_files[i].path.parent_path().string(), i).first->second;
+            }
+            stable_sort(order.begin(), order.end(),
+                        [&group](const size_t a, const size_t b) { return group[a] < group[b]; });
+            break;
+        }
+        default:
+            break;  // in the order found
+    }
+    return order;
+}
+
+void Schedule::run(ThreadPool &thread_pool, function<void(const fs::path &, const uint16_t)> convert,
+                   function<shared_ptr<void>(const fs::path &)> acquire) {
+    _order     = order();
+    auto start = chrono::steady_clock::now();
+    {
+        TaskGroup group;
+        for (size_t index : _order) {
+            // files still queued skip themselves if the user pressed Ctrl-C, see convert_file()
+            if (SignalHandler::termination_requested()) {
+                break;
+            }
+            shared_ptr<void> resources = acquire ? acquire(_files[index].path) : nullptr;
+            thread_pool.enqueue(group, [this, index, &convert, resources](const uint16_t thread_number) {
+                auto file_start = chrono::steady_clock::now();
+                convert(_files[index].path, thread_number);
+                chrono::duration<double> seconds = chrono::steady_clock::now() - file_start;
+                pthread::unique_lock<pthread::mutex> lock(_mutex);
+                _files[index].seconds = seconds.count();
+            });
+        }
+        thread_pool.wait(group);
+    }
+    chrono::duration<double> makespan = chrono::steady_clock::now() - start;
+    _makespan                         = makespan.count();
+}
+
+double Schedule::predict_makespan(const vector<double> &times, const uint16_t number_of_threads) {
+    // the times at which the threads become free, the earliest on top
+    priority_queue<double, vector<double>, greater<double> > free_at;
+    for (uint16_t i = 0; i < number_of_threads; ++i) {
+        free_at.push(0.0);
+    }
+    double makespan = 0.0;
+    for (double time : times) {
+        double end = free_at.top() + time;
+        free_at.pop();
+        free_at.push(end);
+        makespan = max(makespan, end);
+    }
+    return makespan;
+}
+
+string Schedule::report(const uint16_t number_of_threads) const {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    // the time per byte is taken from the conversions actually done, so the prediction tells how well the order
+    // of the files suits the threads and not how well the speed has been guessed
+    uintmax_t total_cost    = 0;
+    double    total_seconds = 0.0;
+    for (size_t index : _order) {
+        total_cost += _files[index].cost;
+        total_seconds += _files[index].seconds;
+    }
+    double         seconds_per_byte = total_cost > 0 ? total_seconds / (double)total_cost : 0.0;
+    vector<double> times;
+    double         longest = 0.0;
+    for (size_t index : _order) {
+        times.push_back(seconds_per_byte * (double)_files[index].cost);
+        longest = max(longest, times.back());
+    }
+    double lower_bound = max(longest, seconds_per_byte * (double)total_cost / number_of_threads);
+
+    ostringstream ss;
+    ss << fixed << setprecision(2);
+    ss << "Schedule \"" << name(_policy) << "\": " << _order.size() << " files processed by " << number_of_threads
+       << " threads in " << _makespan << " s, predicted " << predict_makespan(times, number_of_threads)
+       << " s (at least " << lower_bound << " s)" << endl;
+    return ss.str();
+}
+
+string Schedule::name(const SchedulePolicy policy) {
+    switch (policy) {
+        case SchedulePolicy::stream:
+            return "stream";
+        case SchedulePolicy::fifo:
+            return "fifo";
+        case SchedulePolicy::longest_first:
+            return "longest-first";
+        case SchedulePolicy::shortest_first:
+            return "shortest-first";
+        case SchedulePolicy::directory:
+            return "directory";
+    }
+    return "";
+}
@@ -0,0 +1,73 @@
+//
+// declares class Schedule converting a set of files found beforehand in the order given by a SchedulePolicy
+// The cost of converting a file is estimated by the size of its audio data. Longest first (LPT) keeps the makespan,
+// the time until the last file is converted, short since no long file is left over for the end. Shortest first
+// (SJF) gives the first results fastest, grouping the files by directory keeps the accesses to the disk together.
+// After all files have been converted the makespan predicted from the estimated costs can be compared with the
+// actual one, see report()
+//
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "configuration.h"
+#include "thread_pool.h"
+
+#include "thread_includes.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Schedule {
+  public:
+    explicit Schedule(const SchedulePolicy policy);
+
+    Schedule(const Schedule &) = delete;
+    Schedule &operator=(const Schedule &) = delete;
+
+    // adds a file in the order the files are found and returns its index, the cost is set by set_cost()
+    std::size_t add(const std::filesystem::path &path);
+    // sets the estimated cost of converting the file "index"
+    // may be called from any thread
+    void set_cost(const std::size_t index, const std::uintmax_t cost);
+
+    // enqueues "convert" for every file added to "thread_pool" in the order given by the policy
+    // and waits until all files have been converted
+    // If passed, "acquire" is called in the calling thread before a file is enqueued and may wait, e.g. for memory
+    // to be released. What it returns is kept until the file has been converted
+    void run(ThreadPool &thread_pool, std::function<void(const std::filesystem::path &, const std::uint16_t)> convert,
+             std::function<std::shared_ptr<void>(const std::filesystem::path &)> acquire = nullptr);
+
+    // returns a line comparing the makespan predicted for "number_of_threads" threads with the actual one
+    std::string report(const std::uint16_t number_of_threads) const;
+
+    // returns the name of "policy" as passed with the command line option --schedule
+    static std::string name(const SchedulePolicy policy);
+
+  private:
+    typedef struct File {
+        std::filesystem::path path;
+        std::uintmax_t        cost    = 0;    // size of the audio data in bytes, 0 if not a valid WAV file
+        double                seconds = 0.0;  // time the conversion actually took
+    } File;
+
+    // returns the indices of the files in the order they are converted
+    std::vector<std::size_t> order() const;
+    // simulates converting files taking "times" seconds in that order with "number_of_threads" threads,
+    // every file being taken by the thread becoming free first
+    static double predict_makespan(const std::vector<double> &times, const std::uint16_t number_of_threads);
+
+  private:
+    const SchedulePolicy     _policy;
+    std::vector<File>        _files;     // protected by _mutex
+    std::vector<std::size_t> _order;     // the indices of the files in the order they have been enqueued
+    double                   _makespan;  // seconds from the first file enqueued until the last one was converted
+    mutable pthread::mutex   _mutex;
+};
+
+#endif  // SCHEDULE_H
@@ -18,28 +18,31 @@ SignalHandler::~SignalHandler() {
 }
 
 bool SignalHandler::termination_requested() {
+    sig_atomic_t sig_number = SignalHandler::_signal_received;
+    if (sig_number == 0) {
+        return false;
+    }
     pthread::lock_guard<pthread::mutex> guard(SignalHandler::_mutex);
-    return SignalHandler::_termination_requested;
+    if (!SignalHandler::_termination_requested) {
+        ostringstream ss;
+        if (sig_number == SIGINT) {
+            ss << "Ctrl-C pressed, aborting ..." << endl;
+        } else {
+            ss << "SIGTERM received, aborting ..." << endl;
+        }
+        tcout << ss.str();
+        SignalHandler::_termination_requested = true;
+        set_return_code(RET_ABORTED_BY_SIGINT_OR_SIGTERM);
+    }
+    return true;
 }
 
 void SignalHandler::signal_handler(int sig_number) {
-    ostringstream ss;
-    switch (sig_number) {
-        case SIGINT:
-            ss << "Ctrl-C pressed, aborting ..." << endl;
-            tcout << ss.str();
-            break;
-        case SIGTERM:
-            ss << "SIGTERM received, aborting ..." << endl;
-            tcout << ss.str();
-            break;
-        default:
-            return;
+    if (sig_number == SIGINT || sig_number == SIGTERM) {
+        SignalHandler::_signal_received = sig_number;
     }
-    pthread::lock_guard<pthread::mutex> guard(SignalHandler::_mutex);
-    SignalHandler::_termination_requested = true;
-    set_return_code(RET_ABORTED_BY_SIGINT_OR_SIGTERM);
 }
 
-bool           SignalHandler::_termination_requested = false;
-pthread::mutex SignalHandler::_mutex;
\ No newline at end of file
+volatile sig_atomic_t SignalHandler::_signal_received       = 0;
+bool                  SignalHandler::_termination_requested = false;
+pthread::mutex        SignalHandler::_mutex;
\ No newline at end of file
@@ -3,6 +3,8 @@
 
 #include "thread_includes.h"
 
+#include <csignal>
+
 // class for capturing Ctrl-C (SITINT) and SIGTERM signals
 // intended usage:
 //    - constructing one and only one instace:
@@ -10,6 +12,8 @@
 //      is installed as handler for for the signals SIGINT (Ctrl-C) and SIGTERM
 //    - static function termination_request() returns true if SIGINT and/or SIGTERM was received
 //      and false otherwise
+// The signal handler itself only records the signal, since hardly anything is allowed in a signal handler:
+// the first call of termination_requested() after the signal prints the message and sets the return code
 class SignalHandler {
   public:
     SignalHandler();
@@ -20,9 +24,10 @@ class SignalHandler {
     static bool termination_requested();
 
   private:
-    static bool           _termination_requested;
-    static pthread::mutex _mutex;
-    static void           signal_handler(int signal_code);
+    static volatile std::sig_atomic_t _signal_received;  // the number of the signal received, 0 for none
+    static bool                       _termination_requested;
+    static pthread::mutex             _mutex;
+    static void                       signal_handler(int signal_code);
 };
 
 #endif  // SIGNAL_HANDLER
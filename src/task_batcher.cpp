@@ -0,0 +1,64 @@
+#include "task_batcher.h"
+
+#include <exception>
+#include <memory>
+#include <utility>
+
+using namespace std;
+
+TaskBatcher::TaskBatcher(ThreadPool &thread_pool, const uintmax_t batch_cost)
+    : _thread_pool(thread_pool)
+    , _batch_cost(batch_cost)
+    , _cost(0) {
+}
+
+void TaskBatcher::add(function<void(const uint16_t)> task, const uintmax_t cost) {
+    Batch full_batch;
+    {
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        _batch.push_back(move(task));
+        _cost += cost;
+        if (_cost < _batch_cost) {
+            return;
+        }
+        full_batch.swap(_batch);
+        _cost = 0;
+    }
+    // enqueued without holding the lock, since enqueuing may wait for a free place in the queue of the pool
+    enqueue(move(full_batch));
+}
+
+void TaskBatcher::flush() {
+    Batch batch;
+    {
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        batch.swap(_batch);
+        _cost = 0;
+    }
+    if (!batch.empty()) {
+        enqueue(move(batch));
+    }
+}
+
+void TaskBatcher::enqueue(Batch &&batch) {
+    // std::function requires a copyable target, so the batch is shared instead of moved into the lambda
+    auto tasks = make_shared<Batch>(move(batch));
+    _thread_pool.enqueue([tasks](const uint16_t thread_number) {
+        // a task failing must not keep the following ones from being executed, the first exception is passed on
+        // to the pool after all tasks have been executed
+        exception_ptr error;
+        for (auto &task : *tasks) {
+            try {
+                task(thread_number);
+            } catch (...) {
+                if (!error) {
+                    error = current_exception();
+                }
+            }
+            task = nullptr;  // release what is bound to the task, like open files, as soon as it is done
+        }
+        if (error) {
+            rethrow_exception(error);
+        }
+    });
+}
@@ -0,0 +1,49 @@
+//
+// declares class TaskBatcher packing many small tasks into single tasks of a ThreadPool
+// Every task enqueued costs a std::function, a handoff through a queue and waking up a thread. For tasks doing
+// little work, like converting WAV files of a few seconds, that overhead is significant. So the tasks are collected
+// until their estimated costs add up to the batch size and then enqueued as one task executing them one after
+// the other in the same thread, which also reuses the buffers of that thread
+//
+
+#ifndef TASK_BATCHER_H
+#define TASK_BATCHER_H
+
+#include "thread_pool.h"
+
+#include "thread_includes.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class TaskBatcher {
+  public:
+    // "batch_cost" is the sum of the costs of the tasks collected before they are enqueued to "thread_pool"
+    TaskBatcher(ThreadPool &thread_pool, const std::uintmax_t batch_cost);
+
+    TaskBatcher(const TaskBatcher &) = delete;
+    TaskBatcher &operator=(const TaskBatcher &) = delete;
+
+    // adds "task" with the estimated cost "cost" to the batch and enqueues the batch if it is full
+    // may be called from any thread, enqueuing may block like ThreadPool::enqueue()
+    void add(std::function<void(const std::uint16_t)> task, const std::uintmax_t cost);
+
+    // enqueues the tasks collected so far
+    void flush();
+
+  private:
+    typedef std::vector<std::function<void(const std::uint16_t)> > Batch;
+
+    // enqueues "batch" as a single task
+    void enqueue(Batch &&batch);
+
+  private:
+    ThreadPool &         _thread_pool;
+    const std::uintmax_t _batch_cost;
+    Batch                _batch;  // the tasks collected, protected by _mutex
+    std::uintmax_t       _cost;   // the sum of their costs, protected by _mutex
+    pthread::mutex       _mutex;
+};
+
+#endif  // TASK_BATCHER_H
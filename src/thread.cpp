@@ -16,6 +16,7 @@ pthread::thread::thread(void *(*thread_function)(void *), void *arg_ptr)
 
 void pthread::thread::join() {
     pthread_join(_thread, nullptr);
+    _thread = _invalid_pthread;  // a joined thread must not be cancelled by the destructor anymore
 }
 
 pthread::thread::~thread() {
@@ -1,15 +1,39 @@
 #include "thread_pool.h"
+#include "cpu_resources.h"
 #include "signal_handler.h"
 #include "tiostream.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
+#include <iterator>
 #include <sstream>
+#include <string>
+#include <utility>
 
 using namespace std;
 
-ThreadPool::ThreadPool(const uint16_t num_of_threads)
-    : _threads(num_of_threads)
+// the pool and the number of the worker thread the calling thread is,
+// used to detect functions enqueued by a function running in a worker thread
+static thread_local ThreadPool *current_pool          = nullptr;
+static thread_local uint16_t    current_worker_number = 0;
+
+TaskGroup::TaskGroup()
+    : _pending(0)
+    , _queued(0) {
+}
+
+ThreadPool::ThreadPool(const uint16_t num_of_threads, const size_t queue_depth, const string &name,
+                       function<void(const uint16_t)> initialize_thread)
+    : _workers(num_of_threads)
+    , _name(name)
+    , _initialize_thread(move(initialize_thread))
+    , _injected_tasks(queue_depth > 0 ? queue_depth : num_of_threads)
+    , _queued(0)
+    , _parked_workers(0)
+    , _group_waiters(0)
+    , _active_threads(num_of_threads)
+    , _stop(false)
     , _thread_number(0) {
     if (num_of_threads < 1) {
         ostringstream ss;
@@ -25,43 +49,220 @@ ThreadPool::~ThreadPool() {
 
 void ThreadPool::start_all_threads() {
     pthread::unique_lock<pthread::mutex> lock_args_copied_mutex(_thread_args_copied_mutex);
-    for (uint16_t i = 0; i < _threads.size(); ++i) {
-        _thread_number = i;
-        _threads[i].thread.reset(
+    for (uint16_t i = 0; i < _workers.size(); ++i) {
+        _workers[i].random_state = 2654435761u * (i + 1);  // any non zero seed will do for xorshift
+        _thread_number           = i;
+        _workers[i].thread.reset(
             new pthread::thread(reinterpret_cast<void *(*)(void *)>(&ThreadPool::thread_function), this));
         _thread_args_copied.wait(lock_args_copied_mutex);
     }
 }
 
 void ThreadPool::stop_all_threads() {
-    // notify all threads to terminate by sending a nullptr
-    for (auto &thread : _threads) {
-        thread.queue.enqueue(nullptr);
+    // notify all threads to terminate as soon as no more tasks are queued
+    {
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        _stop = true;
+        _work_available.notify_all();
+        _activated.notify_all();  // inactive workers help executing the tasks still queued
     }
     // then join the threads. The join() method waits until the thread has terminated
-    for (auto &thread : _threads) {
-        thread.thread->join();
+    for (auto &worker : _workers) {
+        worker.thread->join();
     }
 }
 
 void ThreadPool::enqueue(function<void(const uint16_t)> function_to_execute) {
-    // get the number of a thread which is idle
-    // wait if none is idle yet
-    auto number_of_idle_thread = get_next_idle_thread();
-    // now get Thread instance of this thread
-    Thread &thread = _threads[number_of_idle_thread];
-    // now send the function pointer "function_to_execute"
-    // to the thread via its queue. The thread will execute it
-    thread.queue.enqueue(function_to_execute);
-    // returns a future to the promise the caller
+    push({move(function_to_execute), nullptr});
+}
+
+void ThreadPool::enqueue(TaskGroup &group, function<void(const uint16_t)> function_to_execute) {
+    group._pending++;
+    push({move(function_to_execute), &group});
+}
+
+void ThreadPool::push(Task &&task) {
+    // _queued is incremented before the task is queued, so it never drops below zero when an idle worker
+    // takes the task right away
+    _queued++;
+    TaskGroup *group = task.group;
+    if (group) {
+        group->_queued++;
+    }
+    if (current_pool == this) {
+        // a subtask is queued to the worker executing its parent, which takes it next
+        // waiting here could dead lock if all workers are enqueuing subtasks
+        Worker &                             worker = _workers[current_worker_number];
+        pthread::unique_lock<pthread::mutex> lock(worker.mutex);
+        worker.tasks.push_back(move(task));
+    } else {
+        _injected_tasks.enqueue(move(task));  // waits while as many tasks are waiting as there are workers
+    }
+    // wake up a parked worker. _parked_workers is incremented before a parking worker checks _queued,
+    // so either the worker is seen here or it sees the incremented _queued
+    if (_parked_workers > 0) {
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        _work_available.notify_one();
+    }
+    // a worker waiting for the group may take the task itself, see wait()
+    if (group && _group_waiters > 0) {
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        _group_done.notify_all();
+    }
+}
+
+bool ThreadPool::find_task(const uint16_t worker_number, Task &task) {
+    Worker &worker = _workers[worker_number];
+    {
+        pthread::unique_lock<pthread::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty()) {
+            // the task queued last is taken first, since its data is most probably still in the caches
+            task = move(worker.tasks.back());
+            worker.tasks.pop_back();
+            task_taken(task);
+            return true;
+        }
+    }
+    if (_injected_tasks.try_dequeue(task)) {
+        task_taken(task);
+        return true;
+    }
+    return steal(worker_number, task);
+}
+
+bool ThreadPool::steal(const uint16_t thief_number, Task &task) {
+    // start at a random worker, so that not all thieves try the same worker first
+    uint32_t &state = _workers[thief_number].random_state;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    size_t start = state % _workers.size();
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        size_t victim_number = (start + i) % _workers.size();
+        if (victim_number == thief_number) {
+            continue;
+        }
+        Worker &                             victim = _workers[victim_number];
+        pthread::unique_lock<pthread::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            // steal the task queued first, which is the one the victim would execute last
+            task = move(victim.tasks.front());
+            victim.tasks.pop_front();
+            task_taken(task);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::find_group_task(const uint16_t worker_number, TaskGroup &group, Task &task) {
+    for (size_t i = 0; i < _workers.size() && group._queued > 0; ++i) {
+        size_t                               number = (worker_number + i) % _workers.size();
+        Worker &                             worker = _workers[number];
+        pthread::unique_lock<pthread::mutex> lock(worker.mutex);
+        // like find_task() and steal() take the last task of the own deque and the first of the others
+        auto is_of_group = [&group](const Task &queued) { return queued.group == &group; };
+        auto found       = worker.tasks.end();
+        if (number == worker_number) {
+            auto last = find_if(worker.tasks.rbegin(), worker.tasks.rend(), is_of_group);
+            found     = last == worker.tasks.rend() ? worker.tasks.end() : prev(last.base());
+        } else {
+            found = find_if(worker.tasks.begin(), worker.tasks.end(), is_of_group);
+        }
+        if (found != worker.tasks.end()) {
+            task = move(*found);
+            worker.tasks.erase(found);
+            task_taken(task);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::task_taken(const Task &task) {
+    _queued--;
+    if (task.group) {
+        task.group->_queued--;
+    }
+}
+
+template <typename Predicate>
+void ThreadPool::park(Predicate is_done) {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    _parked_workers++;
+    if (_queued == 0 && !is_done()) {
+        _work_available.wait(lock);
+    }
+    _parked_workers--;
+}
+
+void ThreadPool::execute(Task &task, const uint16_t thread_number) {
+    try {
+        // now execute the function
+        task.function(thread_number);
+    } catch (const exception &exc) {
+        ostringstream ss;
+        ss << "(" << thread_number << ") exception thrown: " << exc.what() << endl;
+        tcerr << ss.str();
+    } catch (...) {
+        ostringstream ss;
+        ss << "(" << thread_number << ") unknown exception thrown" << endl;
+        tcerr << ss.str();
+    }
+    task.function = nullptr;  // release everything bound to the function before signaling its completion
+    if (task.group && --task.group->_pending == 0) {
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        _group_done.notify_all();
+    }
 }
 
-int ThreadPool::get_next_idle_thread() {
-    return _idle_threads_queue.dequeue();
+void ThreadPool::wait(TaskGroup &group) {
+    bool is_worker = current_pool == this;
+    while (group._pending != 0) {
+        Task task;
+        if (is_worker && find_group_task(current_worker_number, group, task)) {
+            execute(task, current_worker_number);
+            continue;
+        }
+        // the remaining functions of the group are running in other threads, wait for them to complete
+        // a worker also wakes up if a function of the group is queued which it can help with.
+        // _group_waiters is incremented before the queued functions of the group are checked, so either push()
+        // sees the waiting thread or the thread sees the incremented group._queued
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        _group_waiters++;
+        if (group._pending != 0 && (!is_worker || group._queued == 0)) {
+            _group_done.wait(lock);
+        }
+        _group_waiters--;
+    }
 }
 
-void ThreadPool::notify_being_idle(const uint16_t thread_number) {
-    _idle_threads_queue.enqueue(thread_number);
+void ThreadPool::set_active_threads(uint16_t number_of_threads) {
+    number_of_threads = number_of_threads < 1 ? 1 : number_of_threads;
+    number_of_threads = number_of_threads > _workers.size() ? (uint16_t)_workers.size() : number_of_threads;
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    _active_threads = number_of_threads;
+    _activated.notify_all();
+}
+
+uint16_t ThreadPool::active_threads() const {
+    return _active_threads;
+}
+
+void ThreadPool::wait_while_inactive(const uint16_t thread_number) {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    if (thread_number < _active_threads || _stop) {
+        return;
+    }
+    // the inactive workers wait for their own condition variable, since they must not consume a notification of
+    // _work_available meant for an active worker. If this worker has been woken up for a task just before it was
+    // deactivated, the notification is passed on
+    if (_queued > 0) {
+        _work_available.notify_one();
+    }
+    while (thread_number >= _active_threads && !_stop) {
+        _activated.wait(lock);
+    }
 }
 
 void *ThreadPool::thread_function(ThreadPool *tp) {
@@ -73,29 +274,32 @@ void *ThreadPool::thread_function(ThreadPool *tp) {
         tp->_thread_args_copied.notify_one();  // signals that the _thread_number member of the ThreadPool can now be
                                                // reused to start the next thread
     }
+    current_pool          = tp;
+    current_worker_number = thread_number;
+    name_current_thread(tp->_name + "-" + to_string(thread_number));
+    if (tp->_initialize_thread) {
+        tp->_initialize_thread(thread_number);
+    }
 
-    // now get the queue for receiving commands
-    auto &queue = tp->_threads[thread_number].queue;
     while (true) {
-        tp->notify_being_idle(thread_number);        // signal to be idle and ready for a new task
-        auto function_to_execute = queue.dequeue();  // wait for new function to execute
-        // a nullptr is a request for ending the thread
-        if (function_to_execute == nullptr) {
-            return nullptr;
+        if (thread_number >= tp->_active_threads) {
+            tp->wait_while_inactive(thread_number);
+        }
+        Task task;
+        if (tp->find_task(thread_number, task)) {
+            tp->execute(task, thread_number);
+            continue;
         }
-        // execute the received function
-        try {
-            // now execute the function
-            function_to_execute(thread_number);
-        } catch (const exception &exc) {
-            ostringstream ss;
-            ss << "(" << thread_number << ") exception thrown: " << exc.what() << endl;
-            tcerr << ss.str();
-        } catch (...) {
-            ostringstream ss;
-            ss << "(" << thread_number << ") unknown exception thrown" << endl;
-            tcerr << ss.str();
+        // nothing to do, so wait for new tasks
+        // the thread ends only if the pool is destroyed and all queued tasks have been executed
+        {
+            pthread::unique_lock<pthread::mutex> lock(tp->_mutex);
+            if (tp->_queued == 0 && tp->_stop) {
+                break;
+            }
         }
+        tp->park([tp] { return tp->_stop; });
     }
+    current_pool = nullptr;
     return nullptr;
 }
@@ -5,36 +5,91 @@
 
 #include "thread_includes.h"
 
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
-// implements a pool of threads
+// counts the functions enqueued as part of a group which have not been executed yet
+// see ThreadPool::enqueue(TaskGroup &, ...) and ThreadPool::wait()
+class TaskGroup {
+  public:
+    TaskGroup();
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+  private:
+    friend class ThreadPool;
+    std::atomic<std::size_t> _pending;  // number of functions not executed yet
+    std::atomic<std::size_t> _queued;   // number of functions not taken by a worker yet
+};
+
+// implements a work-stealing pool of threads
 // allows to queue a function to be executed by a worker thread
 // using the "enqueue" method
-// The queuing method "enqueue" blocks until one of the worker threads gets idle
-// and is ready to immediately process the function
+// Every worker thread owns a deque of functions. It executes the function queued last to its own deque and if that
+// is empty it steals the function queued first from the deque of a randomly chosen other worker thread, so that all
+// threads are kept busy even if the execution times of the functions differ a lot.
+// Functions enqueued from outside the pool are passed through a bounded queue all workers take from before
+// stealing. The queuing method "enqueue" blocks as long as the queue is full, so the caller can run ahead of the
+// workers only as far as the depth of the queue passed to the constructor.
+// Functions enqueued by a function running in a worker thread (subtasks) are queued to the deque of that worker
+// without blocking. Passing a TaskGroup allows to wait for the subtasks to complete, see wait()
 
 class ThreadPool {
   public:
-    ThreadPool(const std::uint16_t num_of_threads);
+    // "queue_depth" is the number of functions enqueued from outside the pool which can wait for a free thread
+    // it defaults to the number of threads
+    // The worker threads are named "<name>-<thread number>". Every worker thread calls "initialize_thread", if
+    // passed, with its thread number before executing any function, e.g. for pinning itself to CPUs
+    ThreadPool(const std::uint16_t num_of_threads, const std::size_t queue_depth = 0,
+               const std::string &                      name              = "worker",
+               std::function<void(const std::uint16_t)> initialize_thread = nullptr);
     ~ThreadPool();
 
     // enqueues a function pointer "function_to_execute" to be executed by the next available
     // worker thread. The "function_to_execute" must take as a single argument
     // the number of thread from which it is executed
-    // If all threads are currently busy the method waits until one becomes idle
+    // If called from outside the pool and all threads are currently busy with "queue_depth" functions waiting
+    // the method waits until one of the waiting functions has been started
     void enqueue(std::function<void(const std::uint16_t)> function_to_execute);
+    // same as above, but the function is counted as part of "group" until it has been executed
+    void enqueue(TaskGroup &group, std::function<void(const std::uint16_t)> function_to_execute);
+
+    // waits until all functions enqueued as part of "group" have been executed
+    // If called from a worker thread the thread executes queued functions of the group while waiting, so a function
+    // can wait for its own subtasks even if all other threads are busy. Other functions are left to the other
+    // workers, so the waiting function is not delayed by unrelated ones executed on top of it. Functions of the
+    // group enqueued from outside the pool are left to the other workers as well
+    void wait(TaskGroup &group);
+
+    // limits the worker threads taking functions to the first "number_of_threads" ones (at least one, at most all)
+    // The other workers finish the functions they are executing and then wait until they are activated again,
+    // the functions queued to them are taken over by the active workers. All workers are active initially
+    void set_active_threads(std::uint16_t number_of_threads);
+    std::uint16_t active_threads() const;
 
     // private typedefs
   private:
+    // a function to execute together with the group it belongs to (nullptr if none)
+    typedef struct Task {
+        std::function<void(const std::uint16_t)> function;
+        TaskGroup *                              group = nullptr;
+    } Task;
+
     // struct which stores the actual std::thread
-    // and a queue for sending functions to it to be executed
-    typedef struct Thread {
-        std::shared_ptr<pthread::thread>                       thread;
-        ThreadQueue<std::function<void(const std::uint16_t)> > queue;
-    } Thread;
+    // and the deque of functions queued to it
+    typedef struct Worker {
+        std::shared_ptr<pthread::thread> thread;
+        std::deque<Task>                 tasks;
+        pthread::mutex                   mutex;             // protects tasks
+        std::uint32_t                    random_state = 0;  // used by the worker for choosing threads to steal from
+    } Worker;
 
     // private methods
   private:
@@ -45,12 +100,28 @@ class ThreadPool {
     // Since the thread functions needs a reference to the thread pool
     // and its thread number a pointer to a ThreadArguments struct is passed
     static void *thread_function(ThreadPool *arg_ptr);
-    // returns the next idle worker thread. Waits until one becomes idle if necessary
-    // returns the number of the idle thread
-    int get_next_idle_thread();
-    // meant to be called from inside a thread to mark the thread as idle and therefore
-    // ready to process the next task
-    void notify_being_idle(const std::uint16_t thread_number);
+    // queues "task" to the deque of the calling worker thread or, if called from outside the pool,
+    // to _injected_tasks
+    void push(Task &&task);
+    // takes the next task for the worker "worker_number" from its own deque, from _injected_tasks
+    // or steals one from another worker
+    // returns false if no task is queued at all
+    bool find_task(const std::uint16_t worker_number, Task &task);
+    bool steal(const std::uint16_t thief_number, Task &task);
+    // takes the task of "group" queued last to the deque of the worker "worker_number" or, if there is none,
+    // steals the one queued first to the deque of another worker
+    // returns false if no task of the group is queued to any deque
+    bool find_group_task(const std::uint16_t worker_number, TaskGroup &group, Task &task);
+    // updates the counters of queued tasks after "task" has been taken from a deque or from _injected_tasks
+    void task_taken(const Task &task);
+    // waits until a task is queued or "is_done" returns true, returns immediately if a task is queued already
+    // used by worker threads which found nothing to do
+    template <typename Predicate>
+    void park(Predicate is_done);
+    // executes "task" in the worker thread "thread_number" and updates its group
+    void execute(Task &task, const std::uint16_t thread_number);
+    // waits while the worker thread "thread_number" is not active, see set_active_threads()
+    void wait_while_inactive(const std::uint16_t thread_number);
     // starts all threads
     // helper method for the constructor
     void start_all_threads();
@@ -60,11 +131,24 @@ class ThreadPool {
 
     // private data
   private:
-    std::vector<Thread> _threads;                   // stores Thread instance for each worker thread
-                                                    // the index of the vector is used as the
-                                                    // thread number
-    ThreadQueue<unsigned int> _idle_threads_queue;  // used by the threads to send their number
-                                                    // to the main thread when they become idle
+    std::vector<Worker> _workers;  // stores Worker instance for each worker thread
+                                   // the index of the vector is used as the
+                                   // thread number
+
+    const std::string                              _name;               // prefix of the names of the worker threads
+    const std::function<void(const std::uint16_t)> _initialize_thread;  // called by every worker thread first
+
+    ThreadQueue<Task>          _injected_tasks;  // tasks enqueued from outside the pool
+    std::atomic<std::size_t>   _queued;          // number of tasks queued in all deques and in _injected_tasks
+    std::atomic<std::size_t>   _parked_workers;  // number of worker threads (about to be) waiting for tasks
+    std::atomic<std::size_t>   _group_waiters;   // number of threads (about to be) waiting in wait()
+    std::atomic<std::uint16_t> _active_threads;  // number of worker threads taking tasks, changed under _mutex
+    bool                       _stop;            // set when the pool is destroyed, protected by _mutex
+
+    pthread::mutex              _mutex;           // mutex to use in conjunction with the condition variables below
+    pthread::condition_variable _work_available;  // signals parked workers that a task has been queued
+    pthread::condition_variable _group_done;      // signals wait() that a group is done or a task of a group queued
+    pthread::condition_variable _activated;       // signals inactive workers that more workers are active now
 
     std::uint16_t _thread_number;  // number of currently started thread
                                    // used during startup of all threads
@@ -3,25 +3,120 @@
 
 #include "thread_includes.h"
 
+#include <atomic>
+#include <cstddef>
+#include <memory>
 #include <queue>
 
-// a thread-save queue for passing instances of type T from the main
-// thread to a worker thread
+// thread-save bounded queues for passing instances of type T between any number of threads
+// Two implementations with the same interface are available:
+//     - MutexThreadQueue: an std::queue protected by a mutex, a thread which has to wait since the queue is full
+//       or empty waits on a condition variable
+//     - LockFreeThreadQueue: the lock-free ring buffer described by Dmitry Vyukov
+// ThreadQueue is the one selected at build time: LockFreeThreadQueue by default and MutexThreadQueue if
+// USE_MUTEX_QUEUE is defined (cmake -DUSE_MUTEX_QUEUE=). Both work with the pthread classes and with the
+// C++ 11 threading library. tests/bench_thread_queue.cpp compares them
 
 template <typename T>
-class ThreadQueue {
+class MutexThreadQueue {
   public:
+    // creates a queue with room for "capacity" elements, but at least 1
+    explicit MutexThreadQueue(const std::size_t capacity = 1024);
+
+    MutexThreadQueue(const MutexThreadQueue &) = delete;
+    MutexThreadQueue &operator=(const MutexThreadQueue &) = delete;
+
     // pushed the instance "element" of type T into the queue
+    // waits while the queue is full
     void enqueue(T element);
-    // waits until at least one elemnt is in the queue and
+    // waits until at least one elemnt is in the queue and returns the one pushed first
     T dequeue();
 
+    // same as above but without waiting
+    // return false if the queue is full or empty. try_enqueue() moves from "element" only on success
+    bool try_enqueue(T &element);
+    bool try_dequeue(T &element);
+
   private:
+    const std::size_t           _capacity;
     std::queue<T>               _queue;
     pthread::mutex              _mutex;
-    pthread::condition_variable _cond_var;
+    pthread::condition_variable _not_empty;  // notified after an element has been pushed
+    pthread::condition_variable _not_full;   // notified after an element has been taken
 };
 
+// Every cell of the ring buffer carries a sequence number telling producers and consumers whether it is free or
+// filled, so enqueuing and dequeuing need a single compare and swap. A thread which has to wait since the queue is
+// full or empty spins for a short while before it parks on a condition variable (on single processor systems it
+// parks right away). The mutex is only taken if a thread parks or has to be woken up.
+// T must be default constructible and move assignable
+template <typename T>
+class LockFreeThreadQueue {
+  public:
+    // creates a queue with room for "capacity" elements, but at least 2
+    // (with a single cell a filled cell could not be told apart from a free one)
+    explicit LockFreeThreadQueue(const std::size_t capacity = 1024);
+
+    LockFreeThreadQueue(const LockFreeThreadQueue &) = delete;
+    LockFreeThreadQueue &operator=(const LockFreeThreadQueue &) = delete;
+
+    // see MutexThreadQueue
+    void enqueue(T element);
+    T    dequeue();
+    bool try_enqueue(T &element);
+    bool try_dequeue(T &element);
+
+  private:
+    // number of attempts before a waiting thread parks
+    // spinning only makes sense if the other threads can run meanwhile on other processors
+    static int spin_count();
+
+    // the lock-free part of enqueuing and dequeuing, returns false if the queue is full or empty
+    bool push(T &element);
+    bool pop(T &element);
+
+    typedef struct alignas(64) Cell {
+        std::atomic<std::size_t> sequence;
+        T                        data;
+    } Cell;
+
+    // the threads parked since the queue is full or empty
+    typedef struct Parked {
+        std::atomic<std::size_t>    count{0};          // number of threads parked
+        bool                        notified = false;  // one of them has been notified but has not run yet
+                                                       // so there is no need to notify another one
+        pthread::condition_variable cond_var;
+    } Parked;
+
+    // parks the calling thread in "parked" until "try_operation" succeeds
+    template <typename Operation>
+    void park(Parked &parked, Operation try_operation);
+    // wakes up one of the threads in "parked" if there is one
+    void wake_up(Parked &parked);
+    // same as above but to be called with _mutex locked
+    void notify(Parked &parked);
+
+  private:
+    const std::size_t       _capacity;
+    std::unique_ptr<Cell[]> _cells;
+
+    // the positions are modified by different threads, so they are kept in separate cache lines
+    alignas(64) std::atomic<std::size_t> _enqueue_position;
+    alignas(64) std::atomic<std::size_t> _dequeue_position;
+
+    alignas(64) pthread::mutex _mutex;             // protects the parking of threads
+    Parked                     _parked_producers;  // threads waiting in enqueue() since the queue is full
+    Parked                     _parked_consumers;  // threads waiting in dequeue() since the queue is empty
+};
+
+#ifdef USE_MUTEX_QUEUE
+template <typename T>
+using ThreadQueue = MutexThreadQueue<T>;
+#else
+template <typename T>
+using ThreadQueue = LockFreeThreadQueue<T>;
+#endif
+
 #include "thread_queue_impl.h"
 
 #endif  // THREAD_QUEUE_H
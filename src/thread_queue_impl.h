@@ -1,21 +1,208 @@
 #include "thread_queue.h"
 
+#include <cstdint>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define THREAD_QUEUE_CPU_RELAX() _mm_pause()
+#else
+#define THREAD_QUEUE_CPU_RELAX()
+#endif
+
 using namespace std;
 
 template <typename T>
-void ThreadQueue<T>::enqueue(T element) {
+MutexThreadQueue<T>::MutexThreadQueue(const size_t capacity)
+    : _capacity(capacity > 1 ? capacity : 1) {
+}
+
+template <typename T>
+void MutexThreadQueue<T>::enqueue(T element) {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    while (_queue.size() >= _capacity) {
+        _not_full.wait(lock);
+    }
+    _queue.push(move(element));
+    _not_empty.notify_one();
+}
+
+template <typename T>
+T MutexThreadQueue<T>::dequeue() {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    while (_queue.empty()) {
+        _not_empty.wait(lock);
+    }
+    T element = move(_queue.front());
+    _queue.pop();
+    _not_full.notify_one();
+    return element;
+}
+
+template <typename T>
+bool MutexThreadQueue<T>::try_enqueue(T &element) {
     pthread::unique_lock<pthread::mutex> lock(_mutex);
-    _queue.push(element);
-    _cond_var.notify_one();
+    if (_queue.size() >= _capacity) {
+        return false;
+    }
+    _queue.push(move(element));
+    _not_empty.notify_one();
+    return true;
 }
 
 template <typename T>
-T ThreadQueue<T>::dequeue() {
+bool MutexThreadQueue<T>::try_dequeue(T &element) {
     pthread::unique_lock<pthread::mutex> lock(_mutex);
     if (_queue.empty()) {
-        _cond_var.wait(lock);
+        return false;
     }
-    auto element = _queue.front();
+    element = move(_queue.front());
     _queue.pop();
+    _not_full.notify_one();
+    return true;
+}
+
+template <typename T>
+LockFreeThreadQueue<T>::LockFreeThreadQueue(const size_t capacity)
+    : _capacity(capacity > 2 ? capacity : 2)
+    , _cells(new Cell[_capacity])
+    , _enqueue_position(0)
+    , _dequeue_position(0) {
+    // cell i is free for the element enqueued at position i
+    for (size_t i = 0; i < _capacity; ++i) {
+        _cells[i].sequence.store(i, memory_order_relaxed);
+    }
+}
+
+template <typename T>
+int LockFreeThreadQueue<T>::spin_count() {
+    static const int count = pthread::thread::hardware_concurrency() > 1 ? 100 : 0;
+    return count;
+}
+
+template <typename T>
+bool LockFreeThreadQueue<T>::push(T &element) {
+    size_t position = _enqueue_position.load(memory_order_relaxed);
+    while (true) {
+        Cell &   cell       = _cells[position % _capacity];
+        size_t   sequence   = cell.sequence.load(memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            // the cell is free, try to claim it
+            if (_enqueue_position.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                cell.data = move(element);
+                cell.sequence.store(position + 1, memory_order_release);  // publish the element
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;  // the cell still holds the element enqueued one round before => the queue is full
+        } else {
+            position = _enqueue_position.load(memory_order_relaxed);  // another producer was faster
+        }
+    }
+}
+
+template <typename T>
+bool LockFreeThreadQueue<T>::pop(T &element) {
+    size_t position = _dequeue_position.load(memory_order_relaxed);
+    while (true) {
+        Cell &   cell       = _cells[position % _capacity];
+        size_t   sequence   = cell.sequence.load(memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (difference == 0) {
+            // the cell is filled, try to claim it
+            if (_dequeue_position.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                element   = move(cell.data);
+                cell.data = T();  // do not keep anything the element refers to alive
+                cell.sequence.store(position + _capacity, memory_order_release);  // free the cell for the next round
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;  // the cell has not been filled yet => the queue is empty
+        } else {
+            position = _dequeue_position.load(memory_order_relaxed);  // another consumer was faster
+        }
+    }
+}
+
+template <typename T>
+void LockFreeThreadQueue<T>::enqueue(T element) {
+    bool was_successful = push(element);
+    for (int i = 0; i < spin_count() && !was_successful; ++i) {
+        THREAD_QUEUE_CPU_RELAX();
+        was_successful = push(element);
+    }
+    if (!was_successful) {
+        park(_parked_producers, [this, &element] { return push(element); });
+    }
+    wake_up(_parked_consumers);
+}
+
+template <typename T>
+T LockFreeThreadQueue<T>::dequeue() {
+    T    element;
+    bool was_successful = pop(element);
+    for (int i = 0; i < spin_count() && !was_successful; ++i) {
+        THREAD_QUEUE_CPU_RELAX();
+        was_successful = pop(element);
+    }
+    if (!was_successful) {
+        park(_parked_consumers, [this, &element] { return pop(element); });
+    }
+    wake_up(_parked_producers);
     return element;
 }
+
+template <typename T>
+bool LockFreeThreadQueue<T>::try_enqueue(T &element) {
+    if (!push(element)) {
+        return false;
+    }
+    wake_up(_parked_consumers);
+    return true;
+}
+
+template <typename T>
+bool LockFreeThreadQueue<T>::try_dequeue(T &element) {
+    if (!pop(element)) {
+        return false;
+    }
+    wake_up(_parked_producers);
+    return true;
+}
+
+template <typename T>
+template <typename Operation>
+void LockFreeThreadQueue<T>::park(Parked &parked, Operation try_operation) {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    parked.count++;
+    // the other side checks parked.count after freeing or filling a cell, so either it sees this thread parked
+    // or this thread sees the cell
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!try_operation()) {
+        parked.cond_var.wait(lock);
+        parked.notified = false;
+    }
+    parked.count--;
+    // further cells may have been freed or filled while this thread was notified already,
+    // so pass the wake up on to the next parked thread
+    notify(parked);
+}
+
+template <typename T>
+void LockFreeThreadQueue<T>::wake_up(Parked &parked) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (parked.count.load(memory_order_relaxed) > 0) {
+        // taking the mutex makes sure the parked thread is really waiting and not just about to
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        notify(parked);
+    }
+}
+
+template <typename T>
+void LockFreeThreadQueue<T>::notify(Parked &parked) {
+    if (parked.count > 0 && !parked.notified) {
+        parked.notified = true;
+        parked.cond_var.notify_one();
+    }
+}
@@ -1,11 +1,351 @@
 #include "tiostream.h"
+#include "cpu_resources.h"
 
-pthread::mutex tostream::_mutex;
+#include "thread_includes.h"
 
-tostream::tostream(std::ostream &stream)
-    : _stream(stream) {
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// number of records the ring of a thread holds at most
+static const size_t log_ring_capacity = 512;
+
+// one or more complete lines passed to the writer
+typedef struct LogRecord {
+    ostream *stream = nullptr;
+    string   text;
+} LogRecord;
+
+// the records of a single thread on their way to the writer
+// The thread is the only one pushing and the writer the only one popping, so neither needs a lock
+class LogRing {
+  public:
+    LogRing()
+        : _records(log_ring_capacity)
+        , _head(0)
+        , _tail(0)
+        , _dropped(0)
+        , _is_closed(false) {
+    }
+
+    LogRing(const LogRing &) = delete;
+    LogRing &operator=(const LogRing &) = delete;
+
+    // called by the thread, returns false if the ring is full, moves from "record" only on success
+    bool push(LogRecord &record) {
+        size_t tail = _tail.load(memory_order_relaxed);
+        if (tail - _head.load(memory_order_acquire) == _records.size()) {
+            return false;
+        }
+        _records[tail % _records.size()] = move(record);
+        // sequentially consistent, so either the writer going to sleep sees the record or the thread sees it
+        // sleeping, see LogWriter::wake_up()
+        _tail.store(tail + 1, memory_order_seq_cst);
+        return true;
+    }
+    // called by the writer, returns false if the ring is empty
+    bool pop(LogRecord &record) {
+        size_t head = _head.load(memory_order_relaxed);
+        if (head == _tail.load(memory_order_acquire)) {
+            return false;
+        }
+        record = move(_records[head % _records.size()]);
+        _head.store(head + 1, memory_order_release);
+        return true;
+    }
+    bool is_empty() const {
+        return _head.load(memory_order_relaxed) == _tail.load(memory_order_seq_cst);
+    }
+
+    // the number of records dropped since the ring was full and not reported yet
+    void count_dropped() {
+        _dropped.fetch_add(1, memory_order_relaxed);
+    }
+    size_t take_dropped() {
+        return _dropped.exchange(0, memory_order_relaxed);
+    }
+
+    // called by the thread when it ends, after its last push
+    void close() {
+        _is_closed.store(true, memory_order_release);
+    }
+    bool is_closed() const {
+        return _is_closed.load(memory_order_acquire);
+    }
+
+  private:
+    vector<LogRecord>           _records;
+    alignas(64) atomic<size_t>  _head;  // position of the next record popped, written by the writer only
+    alignas(64) atomic<size_t>  _tail;  // position of the next record pushed, written by the thread only
+    atomic<size_t>              _dropped;
+    atomic<bool>                _is_closed;
+};
+
+// the background thread writing the records of all threads
+class LogWriter {
+  public:
+    LogWriter();
+    // writes all records pushed before and stops the thread
+    ~LogWriter();
+
+    LogWriter(const LogWriter &) = delete;
+    LogWriter &operator=(const LogWriter &) = delete;
+
+    // returns the writer, the first call starts it
+    static LogWriter &instance();
+
+    // lets the writer drain "ring" until it is closed and empty
+    void attach(const shared_ptr<LogRing> &ring);
+    // passes "text" for "stream" through "ring" of the calling thread
+    // drops it if the ring is full and "may_drop" is true, otherwise waits for room
+    void submit(LogRing &ring, ostream &stream, string &&text, const bool may_drop);
+    // waits until all records pushed by any thread before have been written
+    void flush();
+
+  private:
+    static void *thread_function(LogWriter *writer);
+    // writes the records of all rings until the writer is stopped
+    void run();
+    // writes the records found in "rings", returns their number
+    size_t drain(const vector<shared_ptr<LogRing>> &rings);
+    // wakes up the writer if it is sleeping since all rings were empty
+    void wake_up();
+
+  private:
+    pthread::mutex              _mutex;
+    pthread::condition_variable _work_cond;     // notified when the sleeping writer has something to do
+    pthread::condition_variable _written_cond;  // notified after records have been written
+    vector<shared_ptr<LogRing>> _new_rings;     // attached but not taken over by the writer yet, protected by _mutex
+    atomic<bool>                _has_new_rings;
+    atomic<bool>                _is_sleeping;   // the writer found all rings empty and is about to wait or waits
+    bool                        _has_work;      // protected by _mutex
+    bool                        _stop;          // protected by _mutex
+    atomic<size_t>              _submitted;     // number of records pushed
+    size_t                      _written;       // number of records written, protected by _mutex
+    unique_ptr<pthread::thread> _thread;
+};
+
+LogWriter::LogWriter()
+    : _has_new_rings(false)
+    , _is_sleeping(false)
+    , _has_work(false)
+    , _stop(false)
+    , _submitted(0)
+    , _written(0) {
+    _thread.reset(new pthread::thread(reinterpret_cast<void *(*)(void *)>(&LogWriter::thread_function), this));
+}
+
+LogWriter::~LogWriter() {
+    {
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        _stop     = true;
+        _has_work = true;
+        _work_cond.notify_one();
+    }
+    _thread->join();
+}
+
+LogWriter &LogWriter::instance() {
+    static LogWriter writer;
+    return writer;
+}
+
+void LogWriter::attach(const shared_ptr<LogRing> &ring) {
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    _new_rings.push_back(ring);
+    _has_new_rings = true;
+}
+
+void LogWriter::submit(LogRing &ring, ostream &stream, string &&text, const bool may_drop) {
+    LogRecord record;
+    record.stream = &stream;
+    record.text   = move(text);
+    if (!ring.push(record)) {
+        if (may_drop) {
+            ring.count_dropped();
+            return;
+        }
+        // the ring is only full if the writer cannot keep up, so the mutex is rarely taken here
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        while (!ring.push(record)) {
+            _has_work = true;
+            _work_cond.notify_one();
+            _written_cond.wait(lock);
+        }
+    }
+    ++_submitted;
+    wake_up();
+}
+
+void LogWriter::wake_up() {
+    if (_is_sleeping.load(memory_order_seq_cst)) {
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        _has_work = true;
+        _work_cond.notify_one();
+    }
+}
+
+void LogWriter::flush() {
+    size_t                               submitted = _submitted;
+    pthread::unique_lock<pthread::mutex> lock(_mutex);
+    while (_written < submitted) {
+        _written_cond.wait(lock);
+    }
+}
+
+void *LogWriter::thread_function(LogWriter *writer) {
+    name_current_thread("log-writer");
+    writer->run();
+    return nullptr;
+}
+
+void LogWriter::run() {
+    vector<shared_ptr<LogRing>> rings;
+    while (true) {
+        if (_has_new_rings) {
+            pthread::unique_lock<pthread::mutex> lock(_mutex);
+            rings.insert(rings.end(), _new_rings.begin(), _new_rings.end());
+            _new_rings.clear();
+            _has_new_rings = false;
+        }
+        size_t written = drain(rings);
+        // the ring of a thread which has ended is dropped once it has been drained after it was closed
+        rings.erase(remove_if(rings.begin(), rings.end(),
+                              [](const shared_ptr<LogRing> &ring) { return ring->is_closed() && ring->is_empty(); }),
+                    rings.end());
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        if (written > 0) {
+            _written += written;
+            _written_cond.notify_all();
+            continue;
+        }
+        if (_stop) {
+            break;
+        }
+        // a record pushed before the flag is set is found by the check, one pushed after wakes the writer up
+        _is_sleeping.store(true, memory_order_seq_cst);
+        bool has_records = any_of(rings.begin(), rings.end(), [](const shared_ptr<LogRing> &ring) {
+            return !ring->is_empty();
+        });
+        while (!has_records && !_has_new_rings && !_has_work) {
+            _work_cond.wait(lock);
+        }
+        _has_work = false;
+        _is_sleeping.store(false, memory_order_relaxed);
+    }
+}
+
+size_t LogWriter::drain(const vector<shared_ptr<LogRing>> &rings) {
+    size_t    written = 0;
+    size_t    dropped = 0;
+    LogRecord record;
+    for (auto &ring : rings) {
+        // consecutive records of a thread for the same stream are written at once
+        ostream *stream = nullptr;
+        string   text;
+        while (ring->pop(record)) {
+            if (record.stream != stream && !text.empty()) {
+                stream->write(text.data(), text.size());
+                text.clear();
+            }
+            stream = record.stream;
+            text += record.text;
+            ++written;
+        }
+        if (!text.empty()) {
+            stream->write(text.data(), text.size());
+        }
+        dropped += ring->take_dropped();
+    }
+    if (written > 0) {
+        cout.flush();
+        cerr.flush();
+    }
+    if (dropped > 0) {
+        cerr << "WARNING: " << dropped << " lines of output dropped since the output could not keep up\n";
+        cerr.flush();
+    }
+    return written;
+}
+
+// the text inserted by a thread not passed on to the writer yet, since its line is not complete, and the ring
+// passing the complete lines of the thread to the writer
+// its destructor passes on what is left when the thread ends
+class LineBuffer {
+  public:
+    LineBuffer()
+        : stream(nullptr)
+        , ring(make_shared<LogRing>()) {
+        LogWriter::instance().attach(ring);
+    }
+    ~LineBuffer() {
+        pass_on();
+        ring->close();
+    }
+    void pass_on() {
+        if (!text.empty()) {
+            stream->submit(*ring, move(text));
+            text.clear();
+        }
+    }
+
+    tostream *          stream;  // the stream "text" was inserted into
+    string              text;
+    shared_ptr<LogRing> ring;
+};
+
+static thread_local LineBuffer line_buffer;
+
+tostream::tostream(std::ostream &stream, const bool may_drop)
+    : _stream(stream)
+    , _may_drop(may_drop) {
+}
+
+tostream &tostream::operator<<(const string &out) {
+    insert(out);
+    return *this;
+}
+
+tostream &tostream::operator<<(const char *out) {
+    insert(out);
+    return *this;
+}
+
+void tostream::flush() {
+    LogWriter::instance().flush();
+}
+
+void tostream::insert(const string &text) {
+    LineBuffer &buffer = line_buffer;
+    if (buffer.stream != this) {
+        buffer.pass_on();  // an incomplete line inserted into the other stream is not continued
+        buffer.stream = this;
+    }
+    size_t end_of_lines = text.rfind('\n');
+    if (end_of_lines == string::npos) {
+        buffer.text += text;
+        return;
+    }
+    // the usual case of inserting complete lines at once bypasses the buffer
+    if (buffer.text.empty() && end_of_lines + 1 == text.size()) {
+        submit(*buffer.ring, string(text));
+        return;
+    }
+    buffer.text.append(text, 0, end_of_lines + 1);
+    submit(*buffer.ring, move(buffer.text));
+    buffer.text.assign(text, end_of_lines + 1, string::npos);
+}
+
+void tostream::submit(LogRing &ring, string &&text) {
+    LogWriter::instance().submit(ring, _stream, move(text), _may_drop);
 }
 
 // instances of thread safe std::ostream derived classes encapsulating cout and cerr
-tostream tcout(std::cout);
-tostream tcerr(std::cerr);
\ No newline at end of file
+// status lines may be dropped if the output cannot keep up, errors and warnings never
+tostream tcout(std::cout, true);
+tostream tcerr(std::cerr, false);
@@ -1,26 +1,58 @@
+//
+// declares class tostream, a thread safe wrapper of std::ostream, and its instances tcout and tcerr
+// The threads do not write to the streams themselves: every thread collects what it inserts in a buffer of its own
+// until a line is complete, then the complete lines are passed as one record through a ring of the thread to a
+// single background thread draining the rings of all threads and writing the records to std::cout or std::cerr.
+// The thread is the only one pushing into its ring and the writer the only one taking from it, so passing a line on
+// takes no lock shared with the other threads, except for waking up the writer if it sleeps since all rings were
+// empty. A thread never waits for the terminal, and a line is never interleaved with another one.
+// The rings are bounded: if the writer cannot keep up and the ring of a thread is full, its lines for tcout are
+// dropped and counted in the ring, the writer reports their number on std::cerr once it has caught up. Lines for
+// tcerr are never dropped, inserting them waits until there is room in the ring again.
+// The writer is started with the first line and writes all remaining lines when the program exits
+//
+
 #ifndef TIOSTREAM_H
 #define TIOSTREAM_H
 
 #include <iostream>
+#include <sstream>
 #include <string>
-#include "thread_includes.h"
 
-// wrapper class to make streams inherited from std::ostream
-// thread safe
+class LogRing;
 
 class tostream {
   public:
-    tostream(std::ostream &stream);
+    // lines inserted are dropped if the ring of the thread is full and "may_drop" is true
+    // otherwise inserting waits for room in the ring
+    tostream(std::ostream &stream, const bool may_drop);
+
     template <typename T>
     tostream &operator<<(const T &out) {
-        pthread::lock_guard<pthread::mutex> guard(_mutex);
-        _stream << out;
+        std::ostringstream ss;
+        ss << out;
+        insert(ss.str());
         return *this;
     }
+    tostream &operator<<(const std::string &out);
+    tostream &operator<<(const char *out);
+
+    // waits until all complete lines inserted by any thread before have been written
+    // to be called before writing to std::cout or std::cerr directly
+    static void flush();
+
+  private:
+    // appends "text" to the line buffer of the calling thread and passes the complete lines on to the writer
+    void insert(const std::string &text);
+
+    friend class LineBuffer;
+
+    // passes "text" on to the writer as one record through "ring", the ring of the calling thread
+    void submit(LogRing &ring, std::string &&text);
 
   private:
-    static pthread::mutex _mutex;
-    std::ostream &        _stream;
+    std::ostream &_stream;
+    const bool    _may_drop;
 };
 
 // declare thread safe instances encapsulating cout and cerr instatiated in tiostream.cpp
@@ -8,6 +8,7 @@
 
 #include "return_code.h"
 #include "signal_handler.h"
+#include "tiostream.h"
 
 #include <cstdint>
 #include <filesystem>
@@ -35,9 +36,11 @@ int main(int argc, char* argv[]) {
         }
         convert_all_wav_files_in_directory(dir_iter);  // now convert all WAV files in the directory
     } catch (const std::exception& e) {
+        tostream::flush();  // the lines of the threads first
         cerr << "Aborting after exception: " << e.what();
         set_return_code(RET_CODE_EXCEPTION_CAUGHT);
     } catch (...) {
+        tostream::flush();
         cerr << "ERROR: Aborting after unknown exception." << endl;
         set_return_code(RET_CODE_EXCEPTION_CAUGHT);
     }
@@ -0,0 +1,203 @@
+//
+// compares MutexThreadQueue and LockFreeThreadQueue, see thread_queue.h, with 1, 8 and 64 producer and as many
+// consumer threads sharing one queue of 64 bit values:
+//     - throughput: the producers enqueue the values as fast as they can while the consumers dequeue them
+//     - latency: every producer keeps a single value in flight, a consumer passes it back through a second queue of
+//       the same type and the time of the round trip through both queues is measured
+// Not run by ctest, since the numbers only tell something on an otherwise idle machine with several CPUs
+// usage: bench_thread_queue [number of values enqueued by every producer, default 200000]
+//
+
+#include "thread_queue.h"
+
+#include "thread_includes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// the value telling a consumer to stop
+static const uint64_t stop_value = UINT64_MAX;
+
+static int64_t nanoseconds_now() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// lets all threads of a run start at the same time, so starting the threads is not measured
+class StartGate {
+  public:
+    void wait() {
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        while (!_is_open) {
+            _opened.wait(lock);
+        }
+    }
+    void open() {
+        pthread::unique_lock<pthread::mutex> lock(_mutex);
+        _is_open = true;
+        _opened.notify_all();
+    }
+
+  private:
+    pthread::mutex              _mutex;
+    pthread::condition_variable _opened;
+    bool                        _is_open = false;
+};
+
+template <typename Queue>
+struct ThroughputRun {
+    Queue     queue;
+    StartGate gate;
+    uint64_t  values_per_producer = 0;
+};
+
+template <typename Queue>
+static void *produce(void *arg) {
+    auto *run = (ThroughputRun<Queue> *)arg;
+    run->gate.wait();
+    for (uint64_t value = 0; value < run->values_per_producer; ++value) {
+        run->queue.enqueue(value);
+    }
+    return nullptr;
+}
+
+template <typename Queue>
+static void *consume(void *arg) {
+    auto *run = (ThroughputRun<Queue> *)arg;
+    run->gate.wait();
+    while (run->queue.dequeue() != stop_value) {
+    }
+    return nullptr;
+}
+
+// returns the number of values passed through the queue per second
+template <typename Queue>
+static double measure_throughput(const unsigned threads, const uint64_t values_per_producer) {
+    ThroughputRun<Queue> run;
+    run.values_per_producer = values_per_producer;
+    vector<unique_ptr<pthread::thread>> producers;
+    vector<unique_ptr<pthread::thread>> consumers;
+    for (unsigned i = 0; i < threads; ++i) {
+        producers.emplace_back(new pthread::thread(&produce<Queue>, &run));
+        consumers.emplace_back(new pthread::thread(&consume<Queue>, &run));
+    }
+    int64_t start = nanoseconds_now();
+    run.gate.open();
+    for (auto &producer : producers) {
+        producer->join();
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        run.queue.enqueue(stop_value);
+    }
+    for (auto &consumer : consumers) {
+        consumer->join();
+    }
+    double seconds = (double)(nanoseconds_now() - start) / 1e9;
+    return (double)threads * (double)values_per_producer / seconds;
+}
+
+template <typename Queue>
+struct LatencyRun {
+    Queue     requests;
+    Queue     replies;
+    StartGate gate;
+    uint64_t  round_trips_per_client = 0;
+};
+
+// a producer of the latency run keeping one value in flight, the values are the times they were enqueued
+template <typename Queue>
+struct LatencyClient {
+    LatencyRun<Queue> *run = nullptr;
+    vector<int64_t>    round_trips;  // in nanoseconds
+};
+
+template <typename Queue>
+static void *send_requests(void *arg) {
+    auto *             client = (LatencyClient<Queue> *)arg;
+    LatencyRun<Queue> *run    = client->run;
+    run->gate.wait();
+    for (uint64_t i = 0; i < run->round_trips_per_client; ++i) {
+        run->requests.enqueue((uint64_t)nanoseconds_now());
+        // the reply may be the one to the request of another client, which is just as good
+        uint64_t sent = run->replies.dequeue();
+        client->round_trips.push_back(nanoseconds_now() - (int64_t)sent);
+    }
+    return nullptr;
+}
+
+template <typename Queue>
+static void *reply(void *arg) {
+    auto *run = (LatencyRun<Queue> *)arg;
+    run->gate.wait();
+    uint64_t value;
+    while ((value = run->requests.dequeue()) != stop_value) {
+        run->replies.enqueue(value);
+    }
+    return nullptr;
+}
+
+// returns the median and the 99th percentile of the round trips in nanoseconds
+template <typename Queue>
+static pair<int64_t, int64_t> measure_latency(const unsigned threads, const uint64_t round_trips_per_client) {
+    LatencyRun<Queue> run;
+    run.round_trips_per_client = round_trips_per_client;
+    vector<LatencyClient<Queue>> clients(threads);
+    vector<unique_ptr<pthread::thread>> client_threads;
+    vector<unique_ptr<pthread::thread>> reply_threads;
+    for (auto &client : clients) {
+        client.run = &run;
+        client.round_trips.reserve(round_trips_per_client);
+        client_threads.emplace_back(new pthread::thread(&send_requests<Queue>, &client));
+        reply_threads.emplace_back(new pthread::thread(&reply<Queue>, &run));
+    }
+    run.gate.open();
+    for (auto &client_thread : client_threads) {
+        client_thread->join();
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        run.requests.enqueue(stop_value);
+    }
+    for (auto &reply_thread : reply_threads) {
+        reply_thread->join();
+    }
+    vector<int64_t> round_trips;
+    for (auto &client : clients) {
+        round_trips.insert(round_trips.end(), client.round_trips.begin(), client.round_trips.end());
+    }
+    sort(round_trips.begin(), round_trips.end());
+    return {round_trips[round_trips.size() / 2], round_trips[round_trips.size() * 99 / 100]};
+}
+
+template <typename Queue>
+static void measure(const string &name, const unsigned threads, const uint64_t values_per_producer) {
+    double                 values_per_second = measure_throughput<Queue>(threads, values_per_producer);
+    pair<int64_t, int64_t> latency           = measure_latency<Queue>(threads, values_per_producer / 10 + 1);
+    cout << setw(3) << threads << " + " << setw(3) << threads << "   " << left << setw(10) << name << right << fixed
+         << setprecision(2) << setw(10) << values_per_second / 1e6 << " Mvalues/s" << setprecision(1) << setw(10)
+         << (double)latency.first / 1e3 << " us" << setw(10) << (double)latency.second / 1e3 << " us" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t values_per_producer = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+    if (values_per_producer == 0) {
+        cout << "usage: " << argv[0] << " [number of values enqueued by every producer]" << endl;
+        return 1;
+    }
+    cout << pthread::thread::hardware_concurrency() << " CPUs, " << values_per_producer
+         << " values per producer, the queues hold 1024 values" << endl;
+    cout << "producers + consumers   queue    throughput     round trip median / 99 %" << endl;
+    for (unsigned threads : {1u, 8u, 64u}) {
+        measure<MutexThreadQueue<uint64_t>>("mutex", threads, values_per_producer);
+        measure<LockFreeThreadQueue<uint64_t>>("lock-free", threads, values_per_producer);
+    }
+    return 0;
+}
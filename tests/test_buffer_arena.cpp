@@ -0,0 +1,191 @@
+//
+// checks that the conversion of the audio data does not allocate memory per chunk: the buffers of BufferArena are
+// only reallocated when a larger one than ever before is requested, and reading a file chunk by chunk through any of
+// the input backends allocates the same number of times for a short and for a long file. So the number of
+// allocations of a thread does not grow with the length of the files it converts.
+// Every allocation of the process is counted by replacing the global operator new. The encoding itself is left out,
+// so neither lame nor any WAV files are needed, the test writes a temporary file of raw samples.
+// Returns 0 if no allocations per chunk are found and 1 otherwise
+//
+
+#include "buffer_arena.h"
+#include "configuration.h"
+#include "input_file.h"
+#include "sample_conversion.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+// configuration.cpp reports the version of lame, which is not linked
+extern "C" const char *get_lame_version() {
+    return "none";
+}
+
+static atomic<size_t> allocations(0);
+
+void *operator new(size_t size) {
+    ++allocations;
+    void *p = malloc(size > 0 ? size : 1);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void *operator new(size_t size, align_val_t alignment) {
+    ++allocations;
+    size_t align = (size_t)alignment < sizeof(void *) ? sizeof(void *) : (size_t)alignment;
+    void * p     = aligned_alloc(align, (size + align - 1) / align * align);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t, align_val_t) noexcept {
+    free(p);
+}
+
+// the layout of the chunks converted by convert_audio_data(): 16 bit stereo samples, 8192 frames at once
+static const uint32_t bytes_per_sample                 = 2;
+static const uint32_t max_number_of_samples_in_a_chunk = 8192 * 2;
+static const size_t   chunk_size                       = (size_t)max_number_of_samples_in_a_chunk * bytes_per_sample;
+
+// reads the file "filename" chunk by chunk like convert_audio_data() does and unpacks the samples into the buffers
+// of the arena, returns the number of allocations done meanwhile or SIZE_MAX if reading fails
+static size_t allocations_converting(const filesystem::path &filename, const InputBackend backend) {
+    shared_ptr<InputFile> in = InputFile::open(filename, backend);
+    if (!in) {
+        return SIZE_MAX;
+    }
+    size_t         before   = allocations;
+    uintmax_t      position = 0;
+    BufferArena &  arena    = BufferArena::of_current_thread();
+    in->advise_sequential(0, in->size());
+    while (position < in->size()) {
+        uint32_t number_of_samples =
+            (uint32_t)min((uintmax_t)max_number_of_samples_in_a_chunk, (in->size() - position) / bytes_per_sample);
+        int32_t *   pcm_buffer = arena.get<int32_t>(BufferSlot::pcm_samples, number_of_samples);
+        const auto *raw        = (const char *)in->view(position, (size_t)number_of_samples * bytes_per_sample);
+        if (raw == nullptr) {
+            return SIZE_MAX;
+        }
+        unpack_pcm_int_samples(raw, pcm_buffer, number_of_samples, bytes_per_sample, 16);
+        arena.get<unsigned char>(BufferSlot::mp3_data, (size_t)(1.25 * number_of_samples + 7200.0));
+        position += (uintmax_t)number_of_samples * bytes_per_sample;
+        in->release_before(position);
+    }
+    return allocations - before;
+}
+
+// writes a file of "chunks" chunks of raw samples
+static bool write_file(const filesystem::path &filename, const size_t chunks) {
+    ofstream     out(filename, ios::binary | ios::trunc);
+    vector<char> chunk(chunk_size);
+    for (size_t i = 0; i < chunk.size(); ++i) {
+        chunk[i] = (char)(i * 7);
+    }
+    for (size_t i = 0; i < chunks; ++i) {
+        out.write(chunk.data(), chunk.size());
+    }
+    return (bool)out;
+}
+
+static int check_arena() {
+    BufferArena &arena    = BufferArena::of_current_thread();
+    int          failures = 0;
+    size_t       before   = allocations;
+    void *       first    = arena.get<int32_t>(BufferSlot::pcm_samples, 1000);
+    if (allocations - before != 1) {
+        cout << "FAILED: the first buffer of a slot took " << allocations - before << " allocations" << endl;
+        ++failures;
+    }
+    before = allocations;
+    for (size_t count = 1; count <= 1000; ++count) {
+        if (arena.get<int32_t>(BufferSlot::pcm_samples, count) != first) {
+            cout << "FAILED: a buffer not larger than before has been moved" << endl;
+            ++failures;
+            break;
+        }
+    }
+    if (allocations != before) {
+        cout << "FAILED: buffers not larger than before took " << allocations - before << " allocations" << endl;
+        ++failures;
+    }
+    before       = allocations;
+    void *larger = arena.get<int32_t>(BufferSlot::pcm_samples, 100000);
+    void *other  = arena.get<float>(BufferSlot::float_samples, 100000);
+    if (allocations - before != 2) {
+        cout << "FAILED: two larger buffers took " << allocations - before << " allocations" << endl;
+        ++failures;
+    }
+    if ((uintptr_t)larger % BufferArena::alignment != 0 || (uintptr_t)other % BufferArena::alignment != 0) {
+        cout << "FAILED: buffers are not aligned to " << BufferArena::alignment << " bytes" << endl;
+        ++failures;
+    }
+    if (MemoryBudget::peak_allocated() < 2 * 100000 * sizeof(int32_t)) {
+        cout << "FAILED: the buffers are not charged to MemoryBudget" << endl;
+        ++failures;
+    }
+    return failures;
+}
+
+int main() {
+    int failures = check_arena();
+
+    const size_t           short_chunks = 10;
+    const size_t           long_chunks  = 300;
+    const filesystem::path short_file   = filesystem::temp_directory_path() / "wav2mp3_test_short.raw";
+    const filesystem::path long_file    = filesystem::temp_directory_path() / "wav2mp3_test_long.raw";
+    if (!write_file(short_file, short_chunks) || !write_file(long_file, long_chunks)) {
+        cout << "FAILED: could not write the files in " << filesystem::temp_directory_path() << endl;
+        return 1;
+    }
+    const pair<InputBackend, const char *> backends[] = {
+        {InputBackend::ifstream, "ifstream"}, {InputBackend::mmap, "mmap"}, {InputBackend::io_uring, "io_uring"}};
+    for (auto [backend, name] : backends) {
+        // the first file read by a thread may set up resources of the thread, e.g. its io_uring
+        allocations_converting(short_file, backend);
+        size_t short_allocations = allocations_converting(short_file, backend);
+        size_t long_allocations  = allocations_converting(long_file, backend);
+        cout << name << ": " << short_allocations << " allocations for " << short_chunks << " chunks, "
+             << long_allocations << " for " << long_chunks << " chunks" << endl;
+        if (short_allocations == SIZE_MAX || long_allocations == SIZE_MAX) {
+            cout << "FAILED: " << name << ": reading the files failed" << endl;
+            ++failures;
+        } else if (long_allocations != short_allocations) {
+            cout << "FAILED: " << name << ": the number of allocations grows with the length of the file" << endl;
+            ++failures;
+        }
+    }
+    filesystem::remove(short_file);
+    filesystem::remove(long_file);
+
+    if (failures > 0) {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "no allocations per chunk" << endl;
+    return 0;
+}
@@ -0,0 +1,78 @@
+//
+// checks that all SIMD kernels of sample_conversion.cpp supported by the processor yield bit-exactly the same
+// samples as the scalar ones, for every container size, the valid bits used by the WAV files and block lengths
+// covering whole SIMD registers as well as the remainder left to the scalar fallback. The raw data starts at
+// every offset within a register, so unaligned loads are covered as well.
+// Needs neither lame nor any files, returns 0 if all kernels match and 1 otherwise
+//
+
+#include "sample_conversion.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+int main() {
+    const char *   instruction_sets[] = {"AVX-512", "AVX2", "SSE2"};
+    const uint32_t max_samples        = 200;
+    const uint32_t max_offset         = 64;
+
+    mt19937            random(20190601);
+    vector<char>       raw(max_samples * 4 + max_offset);
+    vector<int32_t>    expected(max_samples);
+    vector<int32_t>    samples(max_samples);
+    uniform_int_distribution<int> byte_value(0, 255);
+    for (char &c : raw) {
+        c = (char)byte_value(random);
+    }
+
+    cout << "best instruction set: " << sample_conversion_instruction_set() << endl;
+    int failures = 0;
+    for (const char *instruction_set : instruction_sets) {
+        if (!unpack_pcm_int_samples_using(instruction_set, raw.data(), samples.data(), 0, 2, 16)) {
+            cout << instruction_set << ": not supported by the processor, skipped" << endl;
+            continue;
+        }
+        size_t blocks = 0;
+        for (uint32_t bytes_per_sample = 1; bytes_per_sample <= 4; ++bytes_per_sample) {
+            // 8 bit samples are always 8 bits wide, wider containers may hold fewer valid bits
+            uint32_t min_valid_bits = bytes_per_sample == 1 ? 8 : 8 * bytes_per_sample - 7;
+            for (uint32_t valid_bits = min_valid_bits; valid_bits <= 8 * bytes_per_sample; ++valid_bits) {
+                for (uint32_t offset = 0; offset < max_offset; offset += bytes_per_sample == 1 ? 1 : 3) {
+                    for (uint32_t number_of_samples = 0; number_of_samples <= max_samples; ++number_of_samples) {
+                        const char *block = raw.data() + offset;
+                        unpack_pcm_int_samples_using("scalar", block, expected.data(), number_of_samples,
+                                                     bytes_per_sample, valid_bits);
+                        // samples beyond the block must not be written
+                        memset(samples.data(), 0x5a, samples.size() * sizeof(int32_t));
+                        unpack_pcm_int_samples_using(instruction_set, block, samples.data(), number_of_samples,
+                                                     bytes_per_sample, valid_bits);
+                        ++blocks;
+                        for (uint32_t i = 0; i < max_samples; ++i) {
+                            int32_t wanted = i < number_of_samples ? expected[i] : 0x5a5a5a5a;
+                            if (samples[i] != wanted) {
+                                cout << "FAILED: " << instruction_set << ", " << bytes_per_sample
+                                     << " bytes per sample, " << valid_bits << " valid bits, offset " << offset
+                                     << ", " << number_of_samples << " samples: sample " << i << " is "
+                                     << samples[i] << " instead of " << wanted << endl;
+                                ++failures;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        cout << instruction_set << ": " << blocks << " blocks checked" << endl;
+    }
+    if (failures > 0) {
+        cout << failures << " blocks differ from the scalar kernels" << endl;
+        return 1;
+    }
+    cout << "all kernels match the scalar kernels" << endl;
+    return 0;
+}
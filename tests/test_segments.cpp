@@ -0,0 +1,257 @@
+//
+// checks the MP3 file wav2mp3 writes for a WAV file split into segments (see --segment-seconds) against the one it
+// writes for the whole file using the real lame library, the path of wav2mp3 is passed as the only argument.
+// A synthetic WAV file is converted both ways and both MP3 files are decoded with the decoder of lame:
+//     - both must decode to the same number of samples, so the segments are joined without gaps or overlaps and the
+//       VBR tag frame of the first segment is kept like for the whole file
+//     - no MP3 frame of the split file may refer to the bit reservoir of the frames before it
+//     - the split file may lose some quality against the whole file, since it is encoded without the bit reservoir,
+//       but no more than a few dB signal to noise ratio, neither over the whole file nor around the joins
+// Only built if lame has been built with its decoder, returns 0 if all checks pass and 1 otherwise
+//
+
+#include "mp3_format.h"
+
+#include <lame/lame.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static const uint32_t samples_per_second = 44100;
+static const uint32_t seconds            = 25;
+static const uint32_t segment_seconds    = 5;
+static const size_t   mp3_frame_samples  = 1152;
+
+// the decoder outputs the samples delayed by the encoder and the decoder, this is searched for aligning them
+static const size_t max_delay = 4 * mp3_frame_samples;
+
+// allowed loss of the signal to noise ratio of the split file against the whole file
+static const double max_loss_db = 3.0;
+// allowed loss of the signal to noise ratio around a join against the split file as a whole
+static const double max_join_loss_db = 6.0;
+
+// writes a stereo WAV file of 16 bit samples containing two sweeps and some noise, returns the samples interleaved
+static vector<int16_t> write_wav_file(const fs::path &filename) {
+    const double    pi                = 3.14159265358979323846;
+    const uint32_t  number_of_samples = samples_per_second * seconds;
+    vector<int16_t> samples(2 * (size_t)number_of_samples);
+    uint32_t        noise = 1;
+    for (uint32_t i = 0; i < number_of_samples; ++i) {
+        double t     = (double)i / samples_per_second;
+        noise        = noise * 1664525u + 1013904223u;
+        double left  = 0.3 * sin(2 * pi * (200 * t + 100 * t * t)) + 0.02 * ((double)(noise >> 16) / 65536 - 0.5);
+        double right = 0.3 * sin(2 * pi * (3000 * t - 50 * t * t)) + 0.2 * sin(2 * pi * 440 * t);
+        samples[2 * i]     = (int16_t)lrint(left * 32767);
+        samples[2 * i + 1] = (int16_t)lrint(right * 32767);
+    }
+    auto put = [](ofstream &out, uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            out.put((char)(value >> 8 * i & 0xff));
+        }
+    };
+    uint32_t data_size = (uint32_t)(samples.size() * sizeof(int16_t));
+    ofstream out(filename, ios::binary | ios::trunc);
+    out.write("RIFF", 4);
+    put(out, 36 + data_size, 4);
+    out.write("WAVEfmt ", 8);
+    put(out, 16, 4);
+    put(out, 1, 2);  // PCM
+    put(out, 2, 2);  // channels
+    put(out, samples_per_second, 4);
+    put(out, samples_per_second * 4, 4);
+    put(out, 4, 2);  // block align
+    put(out, 16, 2);
+    out.write("data", 4);
+    put(out, data_size, 4);
+    for (int16_t sample : samples) {
+        put(out, (uint16_t)sample, 2);
+    }
+    return samples;
+}
+
+// converts the WAV files in "directory" by running wav2mp3 with "arguments"
+static bool run_wav2mp3(const string &wav2mp3, const string &arguments, const fs::path &directory) {
+    string command = "\"" + wav2mp3 + "\" " + arguments + " \"" + directory.string() + "\"";
+    cout << command << endl;
+    std::system(command.c_str());  // the return code is not checked, the MP3 file is
+    return fs::exists(directory / "signal.mp3");
+}
+
+static vector<uint8_t> read_file(const fs::path &filename) {
+    ifstream in(filename, ios::binary);
+    return vector<uint8_t>(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+// returns the offsets of all MP3 frames of "mp3", the last element is the end of the last frame
+static vector<size_t> mp3_frames(const vector<uint8_t> &mp3) {
+    vector<size_t> offsets;
+    size_t         offset = id3v2_tag_size(mp3.data(), mp3.size());
+    while (offset < mp3.size()) {
+        size_t size = mp3_frame_size(mp3.data() + offset, mp3.size() - offset);
+        if (size == 0 || size > mp3.size() - offset) {
+            break;
+        }
+        offsets.push_back(offset);
+        offset += size;
+    }
+    offsets.push_back(offset);
+    return offsets;
+}
+
+// returns the number of frames of "mp3" with a main_data_begin other than 0, i.e. using the bit reservoir
+// The first frame is skipped, which is the VBR tag frame
+static size_t frames_using_reservoir(const vector<uint8_t> &mp3, const vector<size_t> &frames) {
+    size_t count = 0;
+    for (size_t i = 1; i + 1 < frames.size(); ++i) {
+        const uint8_t *frame    = mp3.data() + frames[i];
+        bool           is_mpeg1 = (frame[1] >> 3 & 3) == 3;
+        bool           has_crc  = (frame[1] & 1) == 0;
+        const uint8_t *side     = frame + 4 + (has_crc ? 2 : 0);
+        // main_data_begin takes the first 9 bits of the side information for MPEG 1 and 8 bits otherwise
+        uint32_t main_data_begin = is_mpeg1 ? (uint32_t)side[0] << 1 | side[1] >> 7 : side[0];
+        count += main_data_begin != 0 ? 1 : 0;
+    }
+    return count;
+}
+
+// decodes "mp3" frame by frame, returns the samples interleaved
+static vector<int16_t> decode(const vector<uint8_t> &mp3, const vector<size_t> &frames) {
+    vector<int16_t> samples;
+    hip_t           hip = hip_decode_init();
+    short           left[mp3_frame_samples];
+    short           right[mp3_frame_samples];
+    for (size_t i = 0; i + 1 < frames.size(); ++i) {
+        auto *frame = const_cast<unsigned char *>(mp3.data() + frames[i]);
+        int   n     = hip_decode1(hip, frame, frames[i + 1] - frames[i], left, right);
+        while (n > 0) {
+            for (int k = 0; k < n; ++k) {
+                samples.push_back(left[k]);
+                samples.push_back(right[k]);
+            }
+            n = hip_decode1(hip, frame, 0, left, right);
+        }
+        if (n < 0) {
+            cout << "decoding frame " << i << " failed" << endl;
+            break;
+        }
+    }
+    hip_decode_exit(hip);
+    return samples;
+}
+
+// returns the delay of "decoded" against "original" in samples per channel
+static size_t find_delay(const vector<int16_t> &original, const vector<int16_t> &decoded) {
+    size_t best_delay = 0;
+    double best_error = HUGE_VAL;
+    size_t start      = samples_per_second;  // a second in, where the encoder has settled
+    for (size_t delay = 0; delay <= max_delay; ++delay) {
+        double error = 0;
+        for (size_t i = 2 * start; i < 2 * (start + samples_per_second / 2); ++i) {
+            double difference = (double)decoded[i + 2 * delay] - original[i];
+            error += difference * difference;
+        }
+        if (error < best_error) {
+            best_error = error;
+            best_delay = delay;
+        }
+    }
+    return best_delay;
+}
+
+// returns the signal to noise ratio in dB of the samples "first" to "last" (per channel) of "decoded"
+static double snr(const vector<int16_t> &original, const vector<int16_t> &decoded, const size_t delay,
+                  const size_t first, const size_t last) {
+    double signal = 0;
+    double noise  = 0;
+    for (size_t i = 2 * first; i < 2 * last && i + 2 * delay < decoded.size(); ++i) {
+        double difference = (double)decoded[i + 2 * delay] - original[i];
+        signal += (double)original[i] * original[i];
+        noise += difference * difference;
+    }
+    return 10 * log10(signal / max(noise, 1.0));
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        cout << "usage: " << argv[0] << " <path of wav2mp3>" << endl;
+        return 1;
+    }
+    fs::path directory = fs::temp_directory_path() / "wav2mp3_test_segments";
+    fs::remove_all(directory);
+    fs::create_directories(directory / "whole");
+    fs::create_directories(directory / "segmented");
+    vector<int16_t> original = write_wav_file(directory / "whole" / "signal.wav");
+    fs::copy_file(directory / "whole" / "signal.wav", directory / "segmented" / "signal.wav");
+    if (!run_wav2mp3(argv[1], "-t 1", directory / "whole")
+        || !run_wav2mp3(argv[1], "-t 4 --segment-seconds " + to_string(segment_seconds), directory / "segmented")) {
+        cout << "FAILED: wav2mp3 has not written an MP3 file" << endl;
+        return 1;
+    }
+    vector<uint8_t> whole_mp3     = read_file(directory / "whole" / "signal.mp3");
+    vector<uint8_t> segmented_mp3 = read_file(directory / "segmented" / "signal.mp3");
+    fs::remove_all(directory);
+
+    int            failures         = 0;
+    vector<size_t> whole_frames     = mp3_frames(whole_mp3);
+    vector<size_t> segmented_frames = mp3_frames(segmented_mp3);
+    if (whole_frames.back() != whole_mp3.size() || segmented_frames.back() != segmented_mp3.size()) {
+        cout << "FAILED: the MP3 files contain data which is not an MP3 frame" << endl;
+        ++failures;
+    }
+    cout << "frames using the bit reservoir: whole file " << frames_using_reservoir(whole_mp3, whole_frames)
+         << ", split file " << frames_using_reservoir(segmented_mp3, segmented_frames) << endl;
+    if (frames_using_reservoir(segmented_mp3, segmented_frames) != 0) {
+        cout << "FAILED: frames of the split file use the bit reservoir" << endl;
+        ++failures;
+    }
+
+    vector<int16_t> whole     = decode(whole_mp3, whole_frames);
+    vector<int16_t> segmented = decode(segmented_mp3, segmented_frames);
+    cout << "decoded samples: whole file " << whole.size() / 2 << ", split file " << segmented.size() / 2 << endl;
+    if (whole.size() != segmented.size() || whole.size() < original.size()) {
+        cout << "FAILED: the files decode to different or too few samples" << endl;
+        return 1;
+    }
+
+    size_t delay         = find_delay(original, whole);
+    size_t samples       = original.size() / 2;
+    double whole_snr     = snr(original, whole, delay, 0, samples);
+    double segmented_snr = snr(original, segmented, delay, 0, samples);
+    cout << "delay " << delay << " samples, signal to noise ratio: whole file " << whole_snr << " dB, split file "
+         << segmented_snr << " dB" << endl;
+    if (segmented_snr < whole_snr - max_loss_db) {
+        cout << "FAILED: the split file loses more than " << max_loss_db << " dB" << endl;
+        ++failures;
+    }
+    // the segments are joined at the MP3 frame boundaries following every segment_seconds, see
+    // convert_file_in_segments()
+    size_t segment_samples = segment_seconds * samples_per_second / mp3_frame_samples * mp3_frame_samples;
+    for (size_t join = segment_samples; join < samples; join += segment_samples) {
+        size_t first    = join - 2 * mp3_frame_samples;
+        size_t last     = min(join + 2 * mp3_frame_samples, samples);
+        double join_snr = snr(original, segmented, delay, first, last);
+        cout << "join at sample " << join << ": " << join_snr << " dB" << endl;
+        if (join_snr < segmented_snr - max_join_loss_db) {
+            cout << "FAILED: the join at sample " << join << " loses more than " << max_join_loss_db << " dB" << endl;
+            ++failures;
+        }
+    }
+
+    if (failures > 0) {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "the split file matches the whole file" << endl;
+    return 0;
+}